@@ -0,0 +1,74 @@
+#ifndef PICTURE_HPP
+#define PICTURE_HPP
+
+#include <QString>
+#include <QByteArray>
+#include <QSize>
+#include <QFile>
+#include <QImage>
+#include <QImageReader>
+#include <QIODevice>
+
+class Picture
+{
+
+public:
+
+    enum class Check
+    {
+        Header,
+        Decode
+    };
+
+    static QByteArray
+    sniffFormat(const QByteArray &header);
+
+    static QByteArray
+    format(const QString &path);
+
+    static bool
+    isValid(const QString &path,
+            QSize *size = 0,
+            Check check = Check::Header);
+
+    static QImage
+    loadThumbnail(const QString &path, const QSize &max_size);
+
+    static QImage
+    loadEmbeddedThumbnail(const QString &path, const QSize &max_size);
+
+    static QByteArray
+    exifThumbnail(QIODevice *device);
+
+    static QRgb
+    averageColor(const QImage &image);
+
+    static QImage
+    downscale(const QImage &image, const QSize &max_size);
+
+private:
+
+    friend class TestPicture;
+
+    Picture();
+
+    static QImage
+    halve(const QImage &image, bool vectorized = true);
+
+    static QSize
+    targetSize(const QSize &size, const QSize &max_size);
+
+    static QImage
+    embeddedThumbnail(const QByteArray &exif_data,
+                      const QSize &size,
+                      const QSize &target_size);
+
+    static quint32
+    readExifValue(const QByteArray &tiff,
+                  qint64 offset,
+                  int bytes,
+                  bool little_endian);
+
+};
+
+#endif
@@ -10,11 +10,31 @@
 #include <QUrl>
 #include <QThread>
 #include <QMultiMap>
+#include <QPair>
 #include <QVariantMap>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QAtomicInt>
+#include <QElapsedTimer>
 
 #include "scan.hpp"
+#include "picture.hpp"
+#include "thumbnailcache.hpp"
+#include "watcher.hpp"
 
-namespace PlaylistComponents { class Loader; } //I ♥ C++
+namespace PlaylistComponents //I ♥ C++
+{
+    class Loader;
+    class LoaderPool;
+    class LoaderThread;
+    class Importer;
+    class ImportWorker;
+    class CacheWarmer;
+}
+
+class TestLoaderPool;
 
 class Playlist : public QObject
 {
@@ -31,9 +51,27 @@ signals:
     void
     generated();
 
+    void
+    generateProgress(int directories, int files);
+
+    void
+    picturesAdded(const QStringList &addresses);
+
+    void
+    picturesRemoved(const QStringList &addresses);
+
+    void
+    importProgress(int checked, int total);
+
+    void
+    importFinished(int added);
+
     void
     imageLoaded(const QString &address, const QImage &image);
 
+    void
+    thumbnailLoaded(const QString &address, const QImage &image);
+
 public:
 
     enum class Order
@@ -44,17 +82,33 @@ public:
         Random       = 1 << 2,
     };
 
+    enum class ImagePriority
+    {
+        Visible    = 0,
+        Prefetch   = 1,
+        Background = 2
+    };
+
     Playlist(const QStringList &formats, QObject *parent = 0);
 
     Playlist(const QByteArray &serialized, QObject *parent = 0);
 
     Playlist(const Playlist &other, QObject *parent = 0);
 
+    ~Playlist();
+
     QByteArray
     toByteArray() const;
 
 private:
 
+    enum class Change
+    {
+        FilesAdded,
+        FilesRemoved,
+        DirectoryRemoved
+    };
+
     Playlist
     operator=(const Playlist &other);
 
@@ -67,6 +121,9 @@ private:
     QStringList
     _added_picture_files;
 
+    QSet<QString>
+    _added_picture_file_set;
+
     QStringList
     _added_nonrecursive_dirs;
 
@@ -76,30 +133,102 @@ private:
     QList<QUrl>
     _generated_picture_address_list;
 
-    int
-    _loader_thread_maximum_count;
+    QSet<QString>
+    _generated_picture_address_set;
+
+    QStringList
+    _scanned_picture_address_list;
+
+    QList<QPair<Change, QStringList> >
+    _queued_changes;
 
-    QMap<QUrl, QThread*>
+    QSet<QString>
     _running_image_loaders;
 
-    int
-    loaderThreadLimit();
+    QSet<QString>
+    _running_thumbnail_loaders;
 
-    int
-    runningLoaderThreads() const;
+    PlaylistComponents::LoaderPool
+    *_loader_pool;
+
+    Scan
+    *_scan;
+
+    QMap<QThread*, Scan*>
+    _scans;
+
+    Order
+    _generate_order;
+
+    Watcher
+    *_watcher;
+
+    QMap<QThread*, PlaylistComponents::Importer*>
+    _importers;
+
+    QMap<PlaylistComponents::Importer*, int>
+    _import_counts;
+
+    QMap<QThread*, PlaylistComponents::CacheWarmer*>
+    _warmers;
+
+    PlaylistComponents::LoaderPool*
+    loaderPool();
+
+    void
+    setGeneratedList(const QStringList &files, Order order);
+
+    void
+    updateWatcher();
+
+    void
+    applyQueuedChanges();
 
 private slots:
 
     void
     receiveImage(const QUrl &url, const QImage &image);
 
+    void
+    receiveThumbnail(const QUrl &url, const QImage &image);
+
+    void
+    receiveScan(const QStringList &files);
+
+    void
+    receiveScannedPart(const QStringList &files);
+
+    void
+    addWatchedFiles(const QStringList &files);
+
+    void
+    removeWatchedFiles(const QStringList &files);
+
+    void
+    removeWatchedDirectory(const QString &path);
+
+    void
+    regenerate();
+
+    void
+    receiveImportedFiles(const QStringList &files);
+
+    void
+    cleanupImport();
+
+    void
+    cleanupScan();
+
+    void
+    cleanupWarmer();
+
 public:
 
     QString
     name() const;
 
     bool
-    isValidPicture(const QString &path) const;
+    isValidPicture(const QString &path, QSize *size = 0) const;
 
     QStringList
     recursiveDirectories() const;
@@ -119,16 +248,53 @@ public:
     QStringList
     pictureAddressList() const;
 
+    QStringList
+    scannedPictureAddressList() const;
+
     QImage
     loadImage(const QUrl &address) const;
 
+    bool
+    isGenerating() const;
+
+    bool
+    isImporting() const;
+
+    bool
+    isWarmingThumbnailCache() const;
+
 public slots:
 
     void
-    loadImageInBackground(const QUrl &address);
+    loadImageInBackground(const QUrl &address,
+                          int priority = (int)ImagePriority::Visible,
+                          int generation = -1);
+
+    void
+    loadImageInBackground(const QString &address,
+                          int priority = (int)ImagePriority::Visible,
+                          int generation = -1);
+
+    void
+    loadThumbnail(const QUrl &address,
+                  const QSize &max_size,
+                  int priority = (int)ImagePriority::Visible,
+                  int generation = -1);
+
+    void
+    loadThumbnail(const QString &address,
+                  const QSize &max_size,
+                  int priority = (int)ImagePriority::Visible,
+                  int generation = -1);
+
+    void
+    cancelImageRequests(int generation);
 
     void
-    loadImageInBackground(const QString &address);
+    warmThumbnailCache(const QSize &max_size);
+
+    void
+    stopWarmingThumbnailCache();
 
     void
     setName(const QString &name);
@@ -148,6 +314,12 @@ public slots:
     int
     addFiles(const QStringList &paths);
 
+    int
+    importFiles(const QStringList &paths);
+
+    void
+    cancelImport();
+
     void
     removeFile(const QString &path);
 
@@ -157,6 +329,12 @@ public slots:
     void
     generate(Order order = Order::None);
 
+    void
+    generateInBackground(Order order = Order::None);
+
+    void
+    cancelGenerate();
+
     void
     sort(Order order);
 
@@ -166,41 +344,278 @@ class PlaylistComponents::Loader : public QObject
 {
     Q_OBJECT
 
+public:
+
+    Loader(const QVariantMap &runtime_data);
+
+    QImage
+    loadImage(const QUrl &url);
+
+    QImage
+    loadThumbnail(const QUrl &url, const QSize &max_size);
+
+private:
+
+    QVariantMap
+    _runtime_data;
+
+};
+
+class PlaylistComponents::LoaderPool : public QObject
+{
+    Q_OBJECT
+
 signals:
 
     void
-    finished();
+    loaded(const QUrl &url, const QImage &image);
 
     void
-    loaded(const QUrl &url, const QImage &image);
+    thumbnailLoaded(const QUrl &url, const QImage &image);
 
 public:
 
-    Loader(const QVariantMap &runtime_data);
+    struct Request
+    {
+        QUrl url;
+        QSize max_size; //thumbnail if valid
+        int generation;
+    };
+
+    LoaderPool(const QVariantMap &runtime_data,
+               int threads,
+               QObject *parent = 0);
 
-    QMap<QUrl, QImage>
-    loadImages();
+    ~LoaderPool();
+
+    int
+    maximumThreadCount() const;
+
+    int
+    queuedCount() const;
+
+    void
+    work();
+
+    bool
+    promote(const QUrl &url,
+            bool thumbnail,
+            int priority,
+            int generation);
+
+    QList<Request>
+    cancel(int generation);
 
 public slots:
 
+    void
+    enqueue(const QUrl &url,
+            int priority = 0,
+            int generation = -1,
+            const QSize &max_size = QSize());
+
+private:
+
+    friend class ::TestLoaderPool;
+
+    QVariantMap
+    _runtime_data;
+
+    int
+    _max_threads;
+
+    QList<LoaderThread*>
+    _threads;
+
+    int
+    _idle_threads;
+
+    bool
+    _stopping;
+
+    mutable QMutex
+    _mutex;
+
+    QWaitCondition
+    _condition;
+
+    QList<Request>
+    _visible_requests;
+
+    QQueue<Request>
+    _prefetch_requests;
+
+    QQueue<Request>
+    _background_requests;
+
+    int
+    queueSize() const;
+
     bool
-    addUrl(const QUrl &url);
+    take(Request &request);
+
+};
+
+class PlaylistComponents::LoaderThread : public QThread
+{
+
+public:
+
+    LoaderThread(LoaderPool *pool);
+
+protected:
+
+    void
+    run();
+
+private:
+
+    LoaderPool
+    *_pool;
+
+};
+
+class PlaylistComponents::Importer : public QObject
+{
+    Q_OBJECT
+
+signals:
+
+    void
+    finished();
+
+    void
+    imported(const QStringList &files);
+
+    void
+    progress(int checked, int total);
+
+public:
+
+    Importer(const QStringList &paths);
+
+    bool
+    isCanceled() const;
+
+    void
+    work();
+
+public slots:
 
     void
     process();
 
-private slots:
+    void
+    cancel();
 
-    QImage
-    loadImage(const QUrl &url);
+private:
+
+    QStringList
+    _paths;
+
+    QAtomicInt
+    _next;
+
+    QAtomicInt
+    _checked;
+
+    QAtomicInt
+    _canceled;
+
+    QMutex
+    _batch_mutex;
+
+    QStringList
+    _batch;
+
+    QElapsedTimer
+    _batch_timer;
+
+    void
+    report();
+
+};
+
+class PlaylistComponents::CacheWarmer : public QObject
+{
+    Q_OBJECT
+
+signals:
+
+    void
+    finished();
+
+public:
+
+    CacheWarmer(const QStringList &files, const QSize &max_size);
+
+    bool
+    isCanceled() const;
+
+    int
+    createdCount() const;
+
+    void
+    pause();
+
+public slots:
+
+    void
+    process();
+
+    void
+    cancel();
 
 private:
 
-    QVariantMap
-    _runtime_data;
+    QStringList
+    _files;
 
-    QList<QUrl>
-    _urls_to_be_loaded;
+    QSize
+    _max_size;
+
+    QAtomicInt
+    _canceled;
+
+    QAtomicInt
+    _created;
+
+    mutable QMutex
+    _mutex;
+
+    QWaitCondition
+    _condition;
+
+    QElapsedTimer
+    _foreground_timer;
+
+    bool
+    sleep(int ms);
+
+    bool
+    isPaused() const;
+
+    bool
+    isBusy() const;
+
+};
+
+class PlaylistComponents::ImportWorker : public QThread
+{
+
+public:
+
+    ImportWorker(Importer *importer);
+
+protected:
+
+    void
+    run();
+
+private:
+
+    Importer
+    *_importer;
 
 };
 
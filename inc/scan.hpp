@@ -4,12 +4,46 @@
 #include <QObject>
 #include <QStringList>
 #include <QDir>
+#include <QFile>
 #include <QFileInfoList>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QElapsedTimer>
+
+namespace ScanComponents
+{
+    class Walker;
+    class Worker;
+
+    struct DirectoryId
+    {
+        DirectoryId();
+
+        bool
+        operator==(const DirectoryId &other) const;
+
+        quint64 device;
+        quint64 inode;
+        QString path; //only if there's no inode
+    };
+
+    uint
+    qHash(const DirectoryId &id);
+}
+
+class ScanIndex;
 
 class Scan : public QObject
 {
     Q_OBJECT
 
+    friend class ScanComponents::Walker;
+
 signals:
 
     void
@@ -18,6 +52,12 @@ signals:
     void
     scanned(const QStringList &list);
 
+    void
+    found(const QStringList &files);
+
+    void
+    progress(int directories, int files);
+
 public:
 
     enum class RecursionMode
@@ -26,15 +66,45 @@ public:
         Recursive
     };
 
+    enum class SortMode
+    {
+        Sorted,
+        Unsorted
+    };
+
     static QStringList
     scan(const QString &path,
          const QStringList &filters,
-         RecursionMode recursive = RecursionMode::NonRecursive);
+         RecursionMode recursive = RecursionMode::NonRecursive,
+         SortMode sort = SortMode::Sorted);
 
     static QStringList
     scan(const QStringList &paths,
          const QStringList &filters,
-         RecursionMode recursive = RecursionMode::NonRecursive);
+         RecursionMode recursive = RecursionMode::NonRecursive,
+         SortMode sort = SortMode::Sorted);
+
+    static int
+    concurrency();
+
+    static void
+    setConcurrency(int threads);
+
+    static ScanIndex*
+    index();
+
+    static void
+    setIndex(ScanIndex *index);
+
+    static void
+    list(const QString &path,
+         const QStringList &filters,
+         QStringList &files,
+         QStringList &dirs,
+         SortMode sort = SortMode::Sorted);
+
+    static ScanComponents::DirectoryId
+    directoryId(const QString &path);
 
     Scan(const QStringList &paths, const QStringList &filter);
 
@@ -42,6 +112,9 @@ public:
 
     Scan(const QString &path);
 
+    bool
+    isCanceled() const;
+
 public slots:
 
     void
@@ -50,32 +123,207 @@ public slots:
     void
     setPath(const QString &path);
 
+    void
+    addPath(const QString &path, RecursionMode recursive);
+
     void
     setFilter(const QStringList &filter);
 
+    void
+    setSortMode(SortMode sort);
+
     void
     process();
 
+    void
+    cancel();
+
 private:
 
-    static QStringList
-    scan(const QString &path,
+    static int
+    _concurrency;
+
+    static ScanIndex
+    *_index;
+
+    static void
+    read(const QString &path,
          const QStringList &filters,
-         RecursionMode recursive,
-         QStringList &scanned_dirs);
+         QStringList &file_names,
+         QStringList &dir_names,
+         QList<ScanComponents::DirectoryId> *dir_ids,
+         SortMode sort);
+
+    static bool
+    readNative(const QString &path,
+               const QStringList &filters,
+               QStringList &file_names,
+               QStringList &dir_names,
+               QList<ScanComponents::DirectoryId> *dir_ids,
+               SortMode sort);
+
+    static void
+    readPortable(const QString &path,
+                 const QStringList &filters,
+                 QStringList &file_names,
+                 QStringList &dir_names,
+                 QList<ScanComponents::DirectoryId> *dir_ids,
+                 SortMode sort);
 
     QStringList
     _paths;
 
+    QList<RecursionMode>
+    _recursion;
+
     QStringList
     _typefilter;
 
+    SortMode
+    _sort;
+
+    QAtomicInt
+    _canceled;
+
     QStringList
     paths();
 
     QStringList
     filter();
 
+    void
+    reportProgress(int directories, int files);
+
+    void
+    reportFound(const QStringList &files);
+
+};
+
+class ScanComponents::Walker
+{
+
+public:
+
+    Walker(const QStringList &filters, int concurrency,
+           Scan::SortMode sort = Scan::SortMode::Sorted);
+
+    ~Walker();
+
+    void
+    setObserver(Scan *scan, int directories = 0, int files = 0);
+
+    bool
+    isCanceled() const;
+
+    QStringList
+    walk(const QStringList &roots);
+
+    void
+    work(int id);
+
+private:
+
+    struct Node
+    {
+        QString path;
+        QStringList files;
+        QStringList dirs;
+        QList<DirectoryId> dir_ids;
+    };
+
+    struct Queue
+    {
+        QMutex mutex;
+        QList<Node*> nodes;
+    };
+
+    Walker(const Walker &other);
+
+    Walker&
+    operator=(const Walker &other);
+
+    QStringList
+    _filters;
+
+    int
+    _concurrency;
+
+    Scan::SortMode
+    _sort;
+
+    QList<Queue*>
+    _queues;
+
+    QAtomicInt
+    _pending;
+
+    QMutex
+    _idle_mutex;
+
+    QWaitCondition
+    _idle_condition;
+
+    QMutex
+    _visited_mutex;
+
+    QHash<DirectoryId, Node*>
+    _visited_dirs;
+
+    Scan
+    *_observer;
+
+    QAtomicInt
+    _directory_count;
+
+    QAtomicInt
+    _file_count;
+
+    QMutex
+    _report_mutex;
+
+    QElapsedTimer
+    _report_timer;
+
+    QStringList
+    _found_batch;
+
+    bool
+    _reported;
+
+    Node*
+    claim(const QString &path, const DirectoryId &dir_id);
+
+    Node*
+    take(int id);
+
+    void
+    process(int id, Node *node);
+
+    void
+    report(int directories, int files);
+
+};
+
+class ScanComponents::Worker : public QThread
+{
+
+public:
+
+    Worker(Walker *walker, int id);
+
+protected:
+
+    void
+    run();
+
+private:
+
+    Walker
+    *_walker;
+
+    int
+    _id;
+
 };
 
 #endif
@@ -0,0 +1,97 @@
+#ifndef SCANINDEX_HPP
+#define SCANINDEX_HPP
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDataStream>
+#include <QDateTime>
+
+#include "scan.hpp"
+
+class ScanIndex
+{
+
+public:
+
+    static qint64
+    modificationTime(const QString &path);
+
+    ScanIndex();
+
+    QString
+    fileName() const;
+
+    int
+    count() const;
+
+    bool
+    load(const QString &file);
+
+    bool
+    save() const;
+
+    bool
+    lookup(const QString &path,
+           const QStringList &filters,
+           qint64 mtime,
+           QStringList &file_names,
+           QStringList &dir_names);
+
+    void
+    insert(const QString &path,
+           const QStringList &filters,
+           qint64 mtime,
+           const QStringList &file_names,
+           const QStringList &dir_names);
+
+    void
+    setColor(const QString &file, quint32 color);
+
+    QHash<QString, quint32>
+    colors(const QStringList &files) const;
+
+    void
+    clear();
+
+private:
+
+    struct Entry
+    {
+        qint64 mtime;
+        QStringList files;
+        QStringList dirs;
+        QHash<QString, quint32> colors;
+    };
+
+    ScanIndex(const ScanIndex &other);
+
+    ScanIndex&
+    operator=(const ScanIndex &other);
+
+    QString
+    entryPath(const QString &file, QString *name) const;
+
+    mutable QMutex
+    _mutex;
+
+    QString
+    _file;
+
+    QStringList
+    _filters;
+
+    QHash<QString, Entry>
+    _entries;
+
+    QSet<QString>
+    _used_paths;
+
+};
+
+#endif
@@ -42,6 +42,9 @@ private:
     int
     new_cache_limit;
 
+    QCheckBox
+    *chk_warm_cache;
+
     QSpinBox
     *txt_interval_value;
 
@@ -2,6 +2,7 @@
 #define THUMBNAILBOX_HPP
 
 #include <cassert>
+#include <climits>
 
 #include <QDebug>
 #include <QFrame>
@@ -10,16 +11,180 @@
 #include <QScrollBar>
 #include <QLabel>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <qmath.h>
 #include <QFileInfo>
 #include <QDir>
 #include <QMap>
+#include <QHash>
+#include <QSet>
 #include <QPixmap>
 #include <QMouseEvent>
 #include <QMenu>
 #include <QCache>
+#include <QBuffer>
+#include <QThread>
 #include <QPointer>
+#include <QAbstractScrollArea>
+#include <QPainter>
+#include <QPaintEvent>
+#include <qdrawutil.h>
 
-namespace ThumbnailBoxComponents { class Thumb; }
+namespace ThumbnailBoxComponents
+{
+    class Thumb;
+    class ThumbView;
+    class ImageCache;
+    class ImageCodec;
+}
+
+class ThumbnailBoxComponents::ImageCache
+{
+
+public:
+
+    ImageCache(int max_cost = 0);
+
+    int
+    maxCost() const;
+
+    int
+    inMaxCost() const;
+
+    int
+    totalCost() const;
+
+    int
+    warmMaxCost() const;
+
+    int
+    warmCost() const;
+
+    int
+    count() const;
+
+    bool
+    contains(const QString &key) const;
+
+    bool
+    containsCompressed(const QString &key) const;
+
+    QImage
+    object(const QString &key);
+
+    QByteArray
+    compressedObject(const QString &key) const;
+
+    bool
+    insert(const QString &key, const QImage &image, int cost);
+
+    bool
+    insertCompressed(const QString &key, const QByteArray &data);
+
+    bool
+    restore(const QString &key, const QImage &image);
+
+    QHash<QString, QImage>
+    takeEvicted();
+
+    void
+    remove(const QString &key);
+
+    void
+    clear();
+
+    void
+    setMaxCost(int max_cost);
+
+    void
+    setWarmMaxCost(int max_cost);
+
+private:
+
+    enum Queue
+    {
+        In,
+        Main
+    };
+
+    struct Entry
+    {
+        QImage image;
+        int cost;
+        Queue queue;
+        qint64 stamp;
+    };
+
+    struct WarmEntry
+    {
+        QByteArray data;
+        qint64 stamp;
+    };
+
+    int
+    _max_cost;
+
+    int
+    _warm_max_cost;
+
+    int
+    _warm_cost;
+
+    int
+    _total_cost;
+
+    int
+    _in_cost;
+
+    qint64
+    _clock;
+
+    QHash<QString, Entry>
+    _entries;
+
+    QMap<qint64, QString>
+    _in_queue;
+
+    QMap<qint64, QString>
+    _main_queue;
+
+    QHash<QString, qint64>
+    _ghosts;
+
+    QMap<qint64, QString>
+    _ghost_queue;
+
+    QHash<QString, WarmEntry>
+    _warm;
+
+    QMap<qint64, QString>
+    _warm_queue;
+
+    QHash<QString, QImage>
+    _evicted;
+
+    QSet<QString>
+    _compressing;
+
+    bool
+    store(const QString &key, const QImage &image, int cost, Queue queue);
+
+    void
+    take(const QString &key);
+
+    void
+    trim(int max_cost);
+
+    QByteArray
+    takeWarm(const QString &key);
+
+    void
+    trimWarm(int max_cost);
+
+    void
+    forget(const QString &key);
+
+};
 
 class ThumbnailBox : public QFrame
 {
@@ -34,10 +199,28 @@ public:
         External
     };
 
+    enum class Priority
+    {
+        Visible  = 0,
+        Prefetch = 1
+    };
+
+    enum class ViewMode
+    {
+        Widgets,
+        Painted
+    };
+
     typedef ThumbnailBoxComponents::Thumb Thumb;
 
+    typedef ThumbnailBoxComponents::ThumbView ThumbView;
+
+    typedef ThumbnailBoxComponents::ImageCodec ImageCodec;
+
     ThumbnailBox(QWidget *parent);
 
+    ~ThumbnailBox();
+
 signals:
 
     void
@@ -80,11 +263,23 @@ signals:
     middleClicked(int index, const QPoint &pos);
 
     void
-    imageRequested(const QString &path);
+    thumbnailRequested(const QString &path,
+                       const QSize &size,
+                       int priority,
+                       int generation);
+
+    void
+    viewportChanged(int generation);
 
     void
     imageCached(const QString &path = "");
 
+    void
+    compressionRequested(const QString &path, const QImage &image);
+
+    void
+    decompressionRequested(const QString &path, const QByteArray &data);
+
 private:
 
     QPalette
@@ -96,9 +291,15 @@ private:
     int
     _index;
 
+    int
+    _generation;
+
     QStringList
     _list;
 
+    QHash<QString, int>
+    _item_indexes;
+
     double
     _size;
 
@@ -111,15 +312,27 @@ private:
     QSize
     _max_cache_pix_dimensions;
 
-    QMap<int, QColor>
+    QHash<int, QColor>
     _colors;
 
-    QMap<QString, int>
+    QHash<QString, int>
     _file_colors;
 
-    QCache<QString, QImage>
+    QHash<QString, QRgb>
+    _placeholder_colors;
+
+    mutable ThumbnailBoxComponents::ImageCache
     _pixcache;
 
+    int
+    _cache_limit;
+
+    mutable QCache<QString, QPixmap>
+    _display_cache;
+
+    mutable QSize
+    _display_size;
+
     SourceType
     _source_type;
 
@@ -144,6 +357,59 @@ private:
     QMap<int, QPointer<Thumb>>
     _visible_thumbnails_in_viewport;
 
+    QList<Thumb*>
+    _thumb_pool;
+
+    int
+    _thumb_pool_columns;
+
+    int
+    _thumb_pool_width;
+
+    QStringList
+    _visible_paths;
+
+    ThumbView
+    *_view;
+
+    QElapsedTimer
+    _clock;
+
+    qint64
+    _last_scroll_time;
+
+    int
+    _last_top_row;
+
+    int
+    _scroll_direction;
+
+    double
+    _scroll_velocity;
+
+    double
+    _decode_latency;
+
+    QHash<QString, qint64>
+    _request_times;
+
+    QTimer
+    _settle_timer;
+
+    bool
+    _deferred;
+
+    QThread
+    *_codec_thread;
+
+    ImageCodec
+    *_codec;
+
+    QSet<QString>
+    _decompressing;
+
+    friend class ThumbnailBoxComponents::ThumbView;
+
     int
     availableWidth() const;
 
@@ -171,20 +437,59 @@ private:
     QList<int>
     visibleIndexes() const;
 
+    QStringList
+    checkedPaths(const QStringList &paths) const;
+
     QPointer<Thumb>
     thumbAtIndex(int index) const;
 
     QColor
     fileColor(const QString &file) const;
 
+    QColor
+    placeholderColor(const QString &file) const;
+
     QImage
     cachedImage(const QString &file) const;
 
     QPixmap
     cachedPixmap(const QString &file) const;
 
+    QSize
+    previewSize() const;
+
+    void
+    requestImage(const QString &path, Priority priority = Priority::Visible);
+
+    void
+    createThumbPool(int cols, int rows, const QSize &thumb_size);
+
+    void
+    connectThumbSignals(QObject *thumb);
+
+    bool
+    updateVisibleItems();
+
+    void
+    indexItems(int first = 0);
+
+    void
+    updateCacheSize();
+
     void
-    requestImage(const QString &path);
+    compressEvicted();
+
+    qint64
+    thumbnailCost() const;
+
+    void
+    trackScroll();
+
+    void
+    prefetch();
+
+    bool
+    isFlinging() const;
 
 private slots:
 
@@ -203,6 +508,15 @@ private slots:
     void
     updateThumbnail(const QString &file);
 
+    void
+    settleScrolling();
+
+    void
+    receiveCompressed(const QString &file, const QByteArray &data);
+
+    void
+    receiveDecompressed(const QString &file, const QImage &image);
+
 public:
 
     SourceType
@@ -226,6 +540,9 @@ public:
     int
     index() const;
 
+    int
+    generation() const;
+
     bool
     isSelected() const;
 
@@ -250,6 +567,12 @@ public:
     bool
     isMenuEnabled() const;
 
+    QSize
+    previewSizeLimit() const;
+
+    ViewMode
+    viewMode() const;
+
 public slots:
 
     void
@@ -267,6 +590,9 @@ public slots:
     void
     setItemsClickable(bool enable);
 
+    void
+    setViewMode(ViewMode mode);
+
     void
     setCacheLimit(int max_mb);
 
@@ -294,6 +620,9 @@ public slots:
     void
     clearCache();
 
+    void
+    setPlaceholderColors(const QHash<QString, QRgb> &colors);
+
     void
     cacheImage(const QString &file, const QImage &image);
 
@@ -368,6 +697,12 @@ public slots:
     setList(const QStringList &remote_paths, QImage(*loader)(const QString&));
     #endif
 
+    bool
+    append(const QStringList &paths);
+
+    bool
+    remove(const QStringList &paths);
+
 };
 
 class ThumbnailBoxComponents::Thumb : public QFrame
@@ -401,11 +736,17 @@ public:
     
     Thumb(int index, QWidget *parent = 0);
 
+    void
+    setIndex(int index);
+
 public slots:
 
     void
     setPixmap(const QPixmap &preview);
 
+    void
+    setPlaceholder(const QColor &color);
+
     void
     setTitle(const QString &title);
 
@@ -427,4 +768,114 @@ private:
 
 };
 
+class ThumbnailBoxComponents::ThumbView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+signals:
+
+    void
+    clicked(int index);
+
+    void
+    clicked(int index, const QPoint &pos);
+
+    void
+    rightClicked(int index);
+
+    void
+    rightClicked(int index, const QPoint &pos);
+
+    void
+    contextMenuRequested(const QPoint &pos);
+
+    void
+    middleClicked(int index);
+
+    void
+    middleClicked(int index, const QPoint &pos);
+
+public:
+
+    ThumbView(ThumbnailBox *box);
+
+    int
+    itemAt(const QPoint &pos) const;
+
+    QRect
+    itemRect(int index) const;
+
+    QList<int>
+    visibleIndexes() const;
+
+    int
+    topRow() const;
+
+    bool
+    layoutItems();
+
+    void
+    updateItem(int index);
+
+    void
+    scrollToRow(int row);
+
+protected:
+
+    void
+    paintEvent(QPaintEvent *event);
+
+    void
+    mousePressEvent(QMouseEvent *event);
+
+    void
+    resizeEvent(QResizeEvent *event);
+
+    void
+    scrollContentsBy(int dx, int dy);
+
+private:
+
+    ThumbnailBox
+    *_box;
+
+    int
+    _columns;
+
+    int
+    _cell_size;
+
+    int
+    _thumb_size;
+
+    int
+    _count;
+
+    void
+    paintItem(QPainter &painter, int index, const QRect &rect);
+
+};
+
+class ThumbnailBoxComponents::ImageCodec : public QObject
+{
+    Q_OBJECT
+
+signals:
+
+    void
+    compressed(const QString &key, const QByteArray &data);
+
+    void
+    decompressed(const QString &key, const QImage &image);
+
+public slots:
+
+    void
+    compress(const QString &key, const QImage &image);
+
+    void
+    decompress(const QString &key, const QByteArray &data);
+
+};
+
 #endif
@@ -0,0 +1,73 @@
+#ifndef THUMBNAILCACHE_HPP
+#define THUMBNAILCACHE_HPP
+
+#include <QString>
+#include <QByteArray>
+#include <QSize>
+#include <QUrl>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QCryptographicHash>
+#include <QThread>
+
+#include "picture.hpp"
+
+class ThumbnailCache
+{
+
+public:
+
+    static QString
+    defaultDirectory();
+
+    static QString
+    directory();
+
+    static void
+    setDirectory(const QString &path);
+
+    static int
+    thumbnailSize(const QSize &max_size);
+
+    static QString
+    fileName(const QString &path, int size);
+
+    static bool
+    contains(const QString &path, const QSize &max_size);
+
+    static QImage
+    load(const QString &path, const QSize &max_size);
+
+    static bool
+    save(const QString &path, const QImage &thumbnail);
+
+    static QImage
+    create(const QString &path, const QSize &max_size);
+
+    static QImage
+    loadThumbnail(const QString &path, const QSize &max_size);
+
+private:
+
+    ThumbnailCache();
+
+    static QString
+    _directory;
+
+    static QByteArray
+    uri(const QString &path);
+
+    static QString
+    modificationTime(const QString &path);
+
+    static bool
+    isCurrent(QImageReader &reader, const QString &path);
+
+};
+
+#endif
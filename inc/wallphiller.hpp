@@ -53,6 +53,7 @@
 #include <QProcessEnvironment>
 #include <QSystemTrayIcon>
 #include <QSpinBox>
+#include <QCheckBox>
 #include <QFormLayout>
 #include <QProcess>
 #include <QRegExp>
@@ -64,6 +65,8 @@
 #include "settingsdialog.hpp"
 #include "thumbnailbox.hpp"
 #include "playlist.hpp"
+#include "scanindex.hpp"
+#include "thumbnailcache.hpp"
 
 enum class DE
 {
@@ -149,6 +152,9 @@ private:
     int
     _configured_thumbnail_cache_limit;
 
+    bool
+    _configured_thumbnail_warming;
+
     void
     setPlaylistMenu();
 
@@ -158,9 +164,18 @@ private:
     Playlist
     *_current_playlist;
 
+    ScanIndex
+    *_scan_index;
+
     int
     _position;
 
+    int
+    _start_position;
+
+    bool
+    _streaming_list;
+
     QStringList
     _sorted_picture_addresses;
 
@@ -176,6 +191,9 @@ private:
     QString
     _change_routine_command;
 
+    QHash<QString, QRgb>
+    placeholderColors(const QStringList &addresses) const;
+
 private slots:
 
     void
@@ -193,6 +211,24 @@ private slots:
     void
     playlistNameChanged(const QString &name);
 
+    void
+    applyGeneratedList();
+
+    void
+    appendPictures(const QStringList &addresses);
+
+    void
+    removePictures(const QStringList &addresses);
+
+    void
+    showScanProgress(int directories, int files);
+
+    void
+    showImportProgress(int checked, int total);
+
+    void
+    showImportResult(int added);
+
 public:
 
     QStringList
@@ -204,6 +240,9 @@ public:
     int
     cacheLimit() const;
 
+    bool
+    isThumbnailWarmingEnabled() const;
+
     int
     intervalValue() const;
 
@@ -254,6 +293,9 @@ public slots:
     void
     applyCacheLimit(int max_mb);
 
+    void
+    applyThumbnailWarming(bool enable);
+
     void
     generateList();
 
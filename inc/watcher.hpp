@@ -0,0 +1,193 @@
+#ifndef WATCHER_HPP
+#define WATCHER_HPP
+
+#include <QObject>
+#include <QStringList>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QDir>
+#include <QTimer>
+#include <QSocketNotifier>
+#include <QThread>
+#include <QAtomicInt>
+#include <QDebug>
+
+#include "scan.hpp"
+#include "scanindex.hpp"
+
+namespace WatcherComponents
+{
+    struct Directory
+    {
+        QString path;
+        bool recursive;
+        qint64 mtime;
+        QStringList files;
+        QStringList dirs;
+    };
+
+    class Walker;
+}
+
+class Watcher : public QObject
+{
+    Q_OBJECT
+
+signals:
+
+    void
+    filesAdded(const QStringList &files);
+
+    void
+    filesRemoved(const QStringList &files);
+
+    void
+    directoryRemoved(const QString &path);
+
+    void
+    overflowed();
+
+public:
+
+    Watcher(const QStringList &filters, QObject *parent = 0);
+
+    ~Watcher();
+
+    QStringList
+    directories() const;
+
+    int
+    watchCount() const;
+
+    int
+    pollCount() const;
+
+    int
+    pollInterval() const;
+
+    static QList<WatcherComponents::Directory>
+    walk(const QString &path,
+         bool recursive,
+         const QStringList &filters,
+         const QAtomicInt *canceled = 0);
+
+public slots:
+
+    void
+    setDirectories(const QStringList &nonrecursive_dirs,
+                   const QStringList &recursive_dirs);
+
+    void
+    clear();
+
+    void
+    setPollInterval(int seconds);
+
+private:
+
+    typedef WatcherComponents::Directory Directory;
+
+    typedef WatcherComponents::Walker Walker;
+
+    QStringList
+    _filters;
+
+    QStringList
+    _nonrecursive_dirs;
+
+    QStringList
+    _recursive_dirs;
+
+    int
+    _inotify_fd;
+
+    QSocketNotifier
+    *_notifier;
+
+    QHash<int, Directory>
+    _watched_dirs;
+
+    QHash<QString, Directory>
+    _polled_dirs;
+
+    QTimer
+    _poll_timer;
+
+    QMap<QThread*, Walker*>
+    _walkers;
+
+    Walker
+    *_walker;
+
+    bool
+    isMatch(const QString &name) const;
+
+    QStringList
+    addDirectory(const QString &path, bool recursive, bool list_files);
+
+    QStringList
+    watch(const QList<Directory> &directories, bool list_files);
+
+    void
+    removeDirectory(const QString &path);
+
+private slots:
+
+    void
+    readEvents();
+
+    void
+    poll();
+
+    void
+    receiveWalk();
+
+};
+
+class WatcherComponents::Walker : public QObject
+{
+    Q_OBJECT
+
+signals:
+
+    void
+    finished();
+
+public:
+
+    Walker(const QStringList &nonrecursive_dirs,
+           const QStringList &recursive_dirs,
+           const QStringList &filters);
+
+    QList<Directory>
+    directories() const;
+
+public slots:
+
+    void
+    process();
+
+    void
+    cancel();
+
+private:
+
+    QStringList
+    _nonrecursive_dirs;
+
+    QStringList
+    _recursive_dirs;
+
+    QStringList
+    _filters;
+
+    QList<Directory>
+    _directories;
+
+    QAtomicInt
+    _canceled;
+
+};
+
+#endif
@@ -0,0 +1,500 @@
+#include "picture.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PICTURE_SSE2
+#endif
+
+/*! \class Picture
+ *
+ * \brief The Picture class provides helper functions for picture files.
+ *
+ * Checking whether a file is a picture does not require decoding it.
+ * isValid() reads the header only (Check::Header), which is enough
+ * to find out the format and, for most formats, the dimensions.
+ * This is a lot faster than decoding the picture,
+ * which matters when thousands of files are added at once.
+ *
+ * Thumbnails should be loaded using loadThumbnail(), which never
+ * decodes the picture in its full size.
+ * Camera jpegs usually contain a small preview (Exif thumbnail),
+ * which is used instead if it's big enough.
+ *
+ * Pictures that can't be decoded in a smaller size are scaled down
+ * using downscale(), which averages the pixels (no aliasing)
+ * and is a lot faster than a smooth QImage::scaled().
+ *
+ */
+
+/*!
+ * Returns the format (as used by QImageReader) of the picture
+ * starting with header, based on its magic bytes.
+ * Returns an empty string if the format is not known.
+ *
+ * A few bytes (16) are enough.
+ */
+QByteArray
+Picture::sniffFormat(const QByteArray &header)
+{
+    QByteArray format;
+
+    if (header.startsWith("\xFF\xD8\xFF"))
+        format = "jpeg";
+    else if (header.startsWith("\x89PNG\r\n\x1A\n"))
+        format = "png";
+    else if (header.startsWith("GIF87a") || header.startsWith("GIF89a"))
+        format = "gif";
+    else if (header.startsWith("BM"))
+        format = "bmp";
+    else if (header.startsWith(QByteArray("II*\0", 4)) ||
+             header.startsWith(QByteArray("MM\0*", 4)))
+        format = "tiff";
+    else if (header.startsWith("RIFF") && header.mid(8, 4) == "WEBP")
+        format = "webp";
+    else if (header.startsWith(QByteArray("\0\0\1\0", 4)))
+        format = "ico";
+    else if (header.startsWith("/* XPM */"))
+        format = "xpm";
+    else if (header.size() >= 2 && header.at(0) == 'P')
+    {
+        char type = header.at(1); //ASCII or binary
+        if (type == '1' || type == '4') format = "pbm";
+        else if (type == '2' || type == '5') format = "pgm";
+        else if (type == '3' || type == '6') format = "ppm";
+    }
+
+    return format;
+}
+
+/*!
+ * Returns the format of the picture file at path, see sniffFormat().
+ */
+QByteArray
+Picture::format(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+    return sniffFormat(file.read(16));
+}
+
+/*!
+ * Checks if the file located at path is a picture that can be read.
+ * If size is defined, it is set to the dimensions of the picture
+ * (invalid size if they can't be determined without decoding it).
+ *
+ * By default, only the header is read.
+ * A damaged or truncated file may pass this check.
+ * Check::Decode decodes the whole picture.
+ */
+bool
+Picture::isValid(const QString &path, QSize *size, Check check)
+{
+    if (size) *size = QSize();
+
+    //Decode picture (slow)
+    if (check == Check::Decode)
+    {
+        QImage image(path);
+        if (size) *size = image.size();
+        return !image.isNull();
+    }
+
+    //Find format (magic bytes), so the reader doesn't have to guess
+    //Unknown formats are left to the reader (plugins)
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    QByteArray format = sniffFormat(file.peek(16));
+
+    //Read header
+    QImageReader reader(&file, format);
+    if (!reader.canRead()) return false;
+    if (size) *size = reader.size();
+
+    return true;
+}
+
+/*!
+ * Loads the picture at path, scaled down to fit into max_size
+ * (keeping its aspect ratio). Smaller pictures are not scaled.
+ *
+ * The decoder is asked for the target size up front,
+ * so the full-size picture is never decoded (if the decoder supports it).
+ * The jpeg decoder uses DCT scaling, decoding a thumbnail of a large
+ * photo only takes a fraction of the time and memory.
+ * Pictures are scaled after decoding if their size can't be determined
+ * from the header or the decoder ignores the requested size.
+ *
+ * If a jpeg contains an Exif thumbnail that is at least as big
+ * as the requested thumbnail and has the same aspect ratio,
+ * only that one is decoded. It's stored in the first few KB of the file,
+ * so the rest of the file isn't even read.
+ */
+QImage
+Picture::loadThumbnail(const QString &path, const QSize &max_size)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QImage();
+    QByteArray format = sniffFormat(file.peek(16));
+
+    //Embedded thumbnail (Exif), read before the reader touches the file
+    QByteArray exif_data;
+    if (format == "jpeg" && max_size.isValid())
+        exif_data = exifThumbnail(&file);
+
+    //Target size (picture size read from header)
+    QImageReader reader(&file, format);
+    QSize size = reader.size();
+    QSize target_size = targetSize(size, max_size);
+
+    //Use embedded thumbnail if it's big enough
+    QImage image = embeddedThumbnail(exif_data, size, target_size);
+
+    //Decode picture in target size
+    //Only the jpeg decoder can do that (DCT scaling), other readers
+    //would decode it in full size and scale it (slower than downscale())
+    if (image.isNull())
+    {
+        if (target_size != size && format == "jpeg")
+            reader.setScaledSize(target_size);
+        image = reader.read();
+    }
+
+    //Scale if decoded in full size after all
+    if (!image.isNull() && max_size.isValid())
+        image = downscale(image, max_size);
+
+    return image;
+}
+
+/*!
+ * Loads the Exif thumbnail of the jpeg at path, scaled down to fit
+ * into max_size, if it's at least as big as the requested thumbnail
+ * (see loadThumbnail()). Returns a null image otherwise,
+ * only the first few KB of the file are read then.
+ */
+QImage
+Picture::loadEmbeddedThumbnail(const QString &path, const QSize &max_size)
+{
+    QFile file(path);
+    if (!max_size.isValid() || !file.open(QIODevice::ReadOnly))
+        return QImage();
+    QByteArray format = sniffFormat(file.peek(16));
+    if (format != "jpeg") return QImage();
+
+    QByteArray exif_data = exifThumbnail(&file);
+    if (exif_data.isEmpty()) return QImage();
+    QImageReader reader(&file, format);
+    QSize size = reader.size();
+    QImage image = embeddedThumbnail(exif_data, size,
+        targetSize(size, max_size));
+    if (!image.isNull()) image = downscale(image, max_size);
+
+    return image;
+}
+
+/*!
+ * Returns the Exif thumbnail (jpeg data) embedded in the jpeg file
+ * that is read from device or an empty array if there is none.
+ *
+ * Only the segments before the image data are read (usually a few KB),
+ * the position of device is restored.
+ */
+QByteArray
+Picture::exifThumbnail(QIODevice *device)
+{
+    QByteArray thumbnail;
+    qint64 start = device->pos();
+
+    //Find Exif segment (APP1), it's one of the first segments
+    QByteArray tiff;
+    if (device->read(2) == "\xFF\xD8")
+    {
+        forever
+        {
+            QByteArray marker = device->read(4);
+            if (marker.size() < 4 || (uchar)marker.at(0) != 0xFF) break;
+            uchar type = marker.at(1);
+            int length = ((uchar)marker.at(2) << 8 | (uchar)marker.at(3)) - 2;
+            if (length < 0) break;
+            if (type == 0xE1)
+            {
+                QByteArray data = device->read(length);
+                if (data.startsWith(QByteArray("Exif\0\0", 6)))
+                {
+                    tiff = data.mid(6);
+                    break;
+                }
+            }
+            else if ((type >= 0xE0 && type <= 0xEF) || type == 0xFE)
+            {
+                //Other application segment or comment, skip it
+                if (!device->seek(device->pos() + length)) break;
+            }
+            else break; //image data follows, no Exif
+        }
+    }
+    device->seek(start);
+
+    //Byte order
+    bool le = tiff.startsWith("II");
+    if (!le && !tiff.startsWith("MM")) return thumbnail;
+
+    //Find second image directory (IFD1, thumbnail), it follows the first
+    qint64 ifd0 = readExifValue(tiff, 4, 4, le);
+    if (!ifd0) return thumbnail;
+    qint64 ifd0_count = readExifValue(tiff, ifd0, 2, le);
+    qint64 ifd1 = readExifValue(tiff, ifd0 + 2 + ifd0_count * 12, 4, le);
+    if (!ifd1) return thumbnail;
+
+    //Find thumbnail offset and length
+    qint64 offset = 0, length = 0;
+    qint64 ifd1_count = readExifValue(tiff, ifd1, 2, le);
+    for (qint64 i = 0; i < ifd1_count; i++)
+    {
+        qint64 entry = ifd1 + 2 + i * 12;
+        if (entry + 12 > tiff.size()) break;
+        quint32 tag = readExifValue(tiff, entry, 2, le);
+        quint32 value_type = readExifValue(tiff, entry + 2, 2, le);
+        int value_size = value_type == 3 ? 2 : 4; //short or long
+        quint32 value = readExifValue(tiff, entry + 8, value_size, le);
+        if (tag == 0x0201) offset = value; //JPEGInterchangeFormat
+        else if (tag == 0x0202) length = value; //...Length
+    }
+    if (offset && length && offset + length <= tiff.size())
+        thumbnail = tiff.mid(offset, length);
+
+    return thumbnail;
+}
+
+/*!
+ * Returns the average color of image (opaque) or 0 if it's empty.
+ *
+ * It's meant to be computed from a thumbnail, which is decoded anyway,
+ * and shown in place of it while it's loading. At most 64x64 pixels
+ * are sampled.
+ */
+QRgb
+Picture::averageColor(const QImage &image)
+{
+    if (image.isNull()) return 0;
+    QImage rgb_image = image;
+    if (rgb_image.format() != QImage::Format_RGB32 &&
+        rgb_image.format() != QImage::Format_ARGB32)
+        rgb_image = rgb_image.convertToFormat(QImage::Format_ARGB32);
+
+    //Sum sampled pixels
+    int step_x = qMax(rgb_image.width() / 64, 1);
+    int step_y = qMax(rgb_image.height() / 64, 1);
+    quint64 red = 0, green = 0, blue = 0, count = 0;
+    for (int y = 0; y < rgb_image.height(); y += step_y)
+    {
+        const QRgb *line = (const QRgb*)rgb_image.constScanLine(y);
+        for (int x = 0; x < rgb_image.width(); x += step_x)
+        {
+            red += qRed(line[x]);
+            green += qGreen(line[x]);
+            blue += qBlue(line[x]);
+            count++;
+        }
+    }
+
+    return qRgb(red / count, green / count, blue / count);
+}
+
+/*!
+ * Returns a copy of image scaled down to fit into max_size
+ * (keeping its aspect ratio). Smaller images are returned as they are.
+ *
+ * The image is halved (box filter, averaging 2x2 pixels) as long as
+ * it's at least twice the target size, which only takes one pass
+ * over the pixels, then it's resampled smoothly to the target size,
+ * which is cheap at that point.
+ * The result is 32 bit, premultiplied if the image has an alpha channel.
+ * Halving is vectorized (SSE2 or AVX2, if enabled at compile time).
+ *
+ * This function is thread-safe.
+ */
+QImage
+Picture::downscale(const QImage &image, const QSize &max_size)
+{
+    if (image.isNull() || !max_size.isValid()) return image;
+    if (image.width() <= max_size.width() &&
+        image.height() <= max_size.height())
+        return image;
+
+    //Target size
+    QSize target_size = image.size();
+    target_size.scale(max_size, Qt::KeepAspectRatio);
+    target_size = target_size.expandedTo(QSize(1, 1));
+
+    //Premultiplied pixels are averaged correctly
+    QImage::Format format = image.hasAlphaChannel() ?
+        QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    QImage scaled_image = image;
+    if (scaled_image.format() != format)
+        scaled_image = scaled_image.convertToFormat(format);
+
+    //Integer reduction (factor 2)
+    while (scaled_image.width() >= 2 * target_size.width() &&
+           scaled_image.height() >= 2 * target_size.height())
+        scaled_image = halve(scaled_image);
+
+    //Final resampling
+    if (scaled_image.size() != target_size)
+        scaled_image = scaled_image.scaled(target_size, Qt::IgnoreAspectRatio,
+            Qt::SmoothTransformation);
+
+    return scaled_image;
+}
+
+/*!
+ * Returns image (32 bit) in half its size, every pixel is the average
+ * of 2x2 pixels (rounded). An odd last row or column is dropped.
+ * If vectorized is false, only the scalar code is used, which gives
+ * the same result (it's the reference for the vectorized code).
+ */
+QImage
+Picture::halve(const QImage &image, bool vectorized)
+{
+    int width = image.width() / 2;
+    int height = image.height() / 2;
+    QImage half(width, height, image.format());
+    if (half.isNull()) return half;
+
+    for (int y = 0; y < height; y++)
+    {
+        const quint32 *row0 = (const quint32*)image.constScanLine(2 * y);
+        const quint32 *row1 = (const quint32*)image.constScanLine(2 * y + 1);
+        quint32 *out = (quint32*)half.scanLine(y);
+        int x = 0;
+
+        #if defined(__AVX2__)
+        //4 pixels per step: sum 2x2 in 16 bit, +2, >>2
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i two = _mm256_set1_epi16(2);
+        int vector_width = vectorized ? width : 0;
+        for (; x + 4 <= vector_width; x += 4)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(row0 + 2 * x));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(row1 + 2 * x));
+            __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+                _mm256_unpacklo_epi8(b, zero));
+            __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+                _mm256_unpackhi_epi8(b, zero));
+            lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+            hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+            __m256i sum = _mm256_unpacklo_epi64(lo, hi);
+            sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+            __m256i packed = _mm256_packus_epi16(sum, sum);
+            packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i*)(out + x),
+                _mm256_castsi256_si128(packed));
+        }
+        #elif defined(PICTURE_SSE2)
+        //2 pixels per step: sum 2x2 in 16 bit, +2, >>2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two = _mm_set1_epi16(2);
+        int vector_width = vectorized ? width : 0;
+        for (; x + 2 <= vector_width; x += 2)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 2 * x));
+            __m128i b = _mm_loadu_si128((const __m128i*)(row1 + 2 * x));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                _mm_unpackhi_epi8(b, zero));
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            __m128i sum = _mm_unpacklo_epi64(lo, hi);
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+            _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, sum));
+        }
+        #else
+        Q_UNUSED(vectorized);
+        #endif
+
+        //Scalar (remaining pixels), channel by channel
+        for (; x < width; x++)
+        {
+            quint32 p[4] = { row0[2 * x], row0[2 * x + 1],
+                             row1[2 * x], row1[2 * x + 1] };
+            quint32 pixel = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+            {
+                quint32 sum = 2;
+                for (int i = 0; i < 4; i++) sum += (p[i] >> shift) & 0xFF;
+                pixel |= (sum >> 2) << shift;
+            }
+            out[x] = pixel;
+        }
+    }
+
+    return half;
+}
+
+/*!
+ * Returns the size of a picture of the given size, scaled down to fit
+ * into max_size (size itself if it's smaller or invalid).
+ */
+QSize
+Picture::targetSize(const QSize &size, const QSize &max_size)
+{
+    QSize target_size = size;
+    if (size.isValid() && max_size.isValid() &&
+        (size.width() > max_size.width() ||
+         size.height() > max_size.height()))
+    {
+        target_size.scale(max_size, Qt::KeepAspectRatio);
+        target_size = target_size.expandedTo(QSize(1, 1));
+    }
+    return target_size;
+}
+
+/*!
+ * Decodes the Exif thumbnail (exif_data) of a picture of the given size
+ * if it's at least as big as target_size and has the same aspect ratio.
+ * Returns a null image otherwise.
+ */
+QImage
+Picture::embeddedThumbnail(const QByteArray &exif_data,
+                           const QSize &size,
+                           const QSize &target_size)
+{
+    if (exif_data.isEmpty() || !size.isValid()) return QImage();
+
+    //Some cameras add black bars to fit it into 160x120, those don't match
+    QImage preview = QImage::fromData(exif_data, "jpeg");
+    qint64 w = size.width(), h = size.height();
+    qint64 pw = preview.width(), ph = preview.height();
+    bool same_ratio = qAbs(pw * h - ph * w) * 50 <= ph * w; //2%
+    if (preview.isNull() || !same_ratio ||
+        pw < target_size.width() || ph < target_size.height())
+        return QImage();
+
+    return preview;
+}
+
+/*!
+ * Reads an unsigned value (bytes: 2 or 4) at offset from tiff (Exif).
+ * Returns 0 if it's out of range.
+ */
+quint32
+Picture::readExifValue(const QByteArray &tiff,
+                       qint64 offset,
+                       int bytes,
+                       bool little_endian)
+{
+    if (offset < 0 || offset + bytes > tiff.size()) return 0;
+
+    quint32 value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        int pos = little_endian ? bytes - 1 - i : i;
+        value = value << 8 | (uchar)tiff.at(offset + pos);
+    }
+
+    return value;
+}
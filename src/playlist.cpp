@@ -1,5 +1,10 @@
 #include "playlist.hpp"
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 /*! \class Playlist
  *
  * \brief The Playlist class provides an interface to define
@@ -39,7 +44,22 @@
  * Once all required information has been provided to the playlist,
  * loadImage() will take the address and return a QImage object.
  * Alternatively, loadImageInBackground() can be used to let this
- * process run in another thread.
+ * process run in one of the loader threads (see LoaderPool).
+ *
+ * Likewise, generating the list may take a while if a large directory
+ * tree has to be scanned.
+ * generateInBackground() scans in another thread and emits generated()
+ * when the new list is ready. Until then, the old list remains available.
+ * Adding thousands of picture files at once should be done
+ * with importFiles(), which checks them in the background.
+ *
+ * Pictures found by the scan are announced right away by picturesAdded(),
+ * so the caller can show them before the whole tree has been scanned.
+ *
+ * Once the list has been generated, the directories are watched
+ * (see Watcher). New pictures are added to the generated list
+ * and deleted ones are removed (picturesAdded(), picturesRemoved()),
+ * so it doesn't have to be generated again.
  *
  */
 
@@ -49,7 +69,10 @@
 Playlist::Playlist(const QStringList &formats, QObject *parent)
         : QObject(parent),
           _formats(formats),
-          _loader_thread_maximum_count(0)
+          _loader_pool(0),
+          _scan(0),
+          _generate_order(Order::None),
+          _watcher(0)
 {
 }
 
@@ -59,7 +82,10 @@ Playlist::Playlist(const QStringList &formats, QObject *parent)
  */
 Playlist::Playlist(const QByteArray &serialized, QObject *parent)
         : QObject(parent),
-          _loader_thread_maximum_count(0)
+          _loader_pool(0),
+          _scan(0),
+          _generate_order(Order::None),
+          _watcher(0)
 {
     QDataStream stream(serialized);
 
@@ -69,11 +95,14 @@ Playlist::Playlist(const QByteArray &serialized, QObject *parent)
 
     //Added sources
     stream >> _added_picture_files;
+    _added_picture_file_set = _added_picture_files.toSet();
     stream >> _added_nonrecursive_dirs;
     stream >> _added_recursive_dirs;
 
     //Generated list
     stream >> _generated_picture_address_list;
+    foreach (QUrl url, _generated_picture_address_list)
+        _generated_picture_address_set.insert(url.toString());
 
 }
 
@@ -85,6 +114,43 @@ Playlist::Playlist(const Playlist &other, QObject *parent)
 {
 }
 
+/*!
+ * Destroys the Playlist, canceling background scans (if any).
+ */
+Playlist::~Playlist()
+{
+    //Stop scanner threads, they must not outlive their Scan objects
+    _queued_changes.clear(); //nobody's listening anymore
+    cancelGenerate();
+    foreach (QThread *thread, _scans.keys())
+    {
+        thread->quit();
+        thread->wait();
+        delete _scans.value(thread);
+        delete thread;
+    }
+
+    //Same for importer threads
+    cancelImport();
+    foreach (QThread *thread, _importers.keys())
+    {
+        thread->quit();
+        thread->wait();
+        delete _importers.value(thread);
+        delete thread;
+    }
+
+    //And cache warmers
+    stopWarmingThumbnailCache();
+    foreach (QThread *thread, _warmers.keys())
+    {
+        thread->quit();
+        thread->wait();
+        delete _warmers.value(thread);
+        delete thread;
+    }
+}
+
 /*!
  * Serializes this playlist into a QByteArray.
  */
@@ -111,34 +177,318 @@ const
     return bytes;
 }
 
-int
-Playlist::loaderThreadLimit()
+PlaylistComponents::LoaderPool*
+Playlist::loaderPool()
 {
-    //Calculate loader thread limit once
-    if (!_loader_thread_maximum_count)
+    //Include components
+    using namespace PlaylistComponents;
+
+    //Create loader pool on first request
+    //We used to spawn one thread per request,
+    //queueing threads if too many were running.
+    //Many requests meant many threads that were constantly being
+    //created and destroyed, and all the queued threads took up memory
+    //(1.5 GB in seconds with many requests coming in).
+    //The pool has a fixed number of threads, which take
+    //the requests from a queue, one after the other.
+    if (!_loader_pool)
     {
-        int new_limit = QThread::idealThreadCount();
-        if (new_limit < 1) new_limit = 1; //we want to write 2...
-        _loader_thread_maximum_count = new_limit;
+        QVariantMap data; //runtime/session data (like username and password)
+        int threads = QThread::idealThreadCount();
+        if (threads < 1) threads = 1; //we want to write 2...
+        _loader_pool = new LoaderPool(data, threads, this);
+
+        //Retrieve images when done
+        connect(_loader_pool,
+                SIGNAL(loaded(const QUrl&, const QImage&)),
+                this,
+                SLOT(receiveImage(const QUrl&, const QImage&)));
+        connect(_loader_pool,
+                SIGNAL(thumbnailLoaded(const QUrl&, const QImage&)),
+                this,
+                SLOT(receiveThumbnail(const QUrl&, const QImage&)));
     }
-    return _loader_thread_maximum_count;
+
+    return _loader_pool;
 }
 
-int
-Playlist::runningLoaderThreads()
-const
+void
+Playlist::setGeneratedList(const QStringList &files, Order order)
+{
+    QList<QUrl> &generated_list = _generated_picture_address_list; //reference
+    generated_list.clear();
+    _generated_picture_address_set.clear();
+
+    //Manually selected local files
+    foreach (QString file, localPictureFiles())
+    {
+        generated_list << QUrl::fromLocalFile(file);
+    }
+
+    //Scanned files
+    foreach (QString file, files)
+    {
+        generated_list << QUrl::fromLocalFile(file);
+    }
+
+    //Address set, kept up to date by the watcher slots
+    foreach (QUrl url, generated_list)
+        _generated_picture_address_set.insert(url.toString());
+
+    //Sort
+    if (order != Order::None)
+        sort(order);
+
+    //Watch for changes from now on
+    updateWatcher();
+
+    emit generated();
+
+    //Changes reported while the list was being generated
+    applyQueuedChanges();
+}
+
+void
+Playlist::receiveScan(const QStringList &files)
+{
+    //Ignore results of old (replaced) scans
+    if (sender() != _scan) return;
+    _scan = 0;
+    _scanned_picture_address_list.clear();
+
+    setGeneratedList(files, _generate_order);
+}
+
+void
+Playlist::updateWatcher()
+{
+    //Watch directories (only changed if the definition has changed)
+    if (!_watcher)
+    {
+        _watcher = new Watcher(_formats, this);
+        connect(_watcher,
+                SIGNAL(filesAdded(const QStringList&)),
+                SLOT(addWatchedFiles(const QStringList&)));
+        connect(_watcher,
+                SIGNAL(filesRemoved(const QStringList&)),
+                SLOT(removeWatchedFiles(const QStringList&)));
+        connect(_watcher,
+                SIGNAL(directoryRemoved(const QString&)),
+                SLOT(removeWatchedDirectory(const QString&)));
+        connect(_watcher,
+                SIGNAL(overflowed()),
+                SLOT(regenerate()));
+    }
+    _watcher->setDirectories(nonrecursiveDirectories(),
+        recursiveDirectories());
+}
+
+/*!
+ * Applies the changes that have been reported by the watcher
+ * while the list was being generated, in order.
+ * The scan may or may not have seen them, applying them again
+ * doesn't change anything then.
+ */
+void
+Playlist::applyQueuedChanges()
+{
+    QList<QPair<Change, QStringList> > changes = _queued_changes;
+    _queued_changes.clear();
+    for (int i = 0, ii = changes.size(); i < ii; i++)
+    {
+        const QStringList &paths = changes.at(i).second;
+        switch (changes.at(i).first)
+        {
+            case Change::FilesAdded:
+            addWatchedFiles(paths);
+            break;
+
+            case Change::FilesRemoved:
+            removeWatchedFiles(paths);
+            break;
+
+            case Change::DirectoryRemoved:
+            removeWatchedDirectory(paths.value(0));
+            break;
+        }
+    }
+}
+
+void
+Playlist::addWatchedFiles(const QStringList &files)
+{
+    //Changes during a scan are applied once it's done
+    if (isGenerating())
+    {
+        _queued_changes << qMakePair(Change::FilesAdded, files);
+        return;
+    }
+
+    //Append new pictures (unless already in the list)
+    QStringList addresses;
+    foreach (QString file, files)
+    {
+        QUrl url = QUrl::fromLocalFile(file);
+        QString address = url.toString();
+        if (_generated_picture_address_set.contains(address)) continue;
+        _generated_picture_address_set.insert(address);
+        _generated_picture_address_list << url;
+        addresses << address;
+    }
+    if (!addresses.isEmpty()) emit picturesAdded(addresses);
+}
+
+void
+Playlist::removeWatchedFiles(const QStringList &files)
+{
+    if (isGenerating())
+    {
+        _queued_changes << qMakePair(Change::FilesRemoved, files);
+        return;
+    }
+
+    //Remove deleted pictures (that are in the list)
+    //Manually added files are kept, they're not part of the scan
+    QSet<QString> removed_files;
+    foreach (QString file, files)
+    {
+        if (_added_picture_file_set.contains(file)) continue;
+        QString address = QUrl::fromLocalFile(file).toString();
+        if (!_generated_picture_address_set.remove(address)) continue;
+        removed_files.insert(file);
+    }
+    if (removed_files.isEmpty()) return;
+    QStringList addresses;
+    QList<QUrl> &generated_list = _generated_picture_address_list; //reference
+    int remaining = removed_files.size();
+    for (int i = generated_list.size() - 1; i >= 0 && remaining; i--)
+    {
+        if (!removed_files.contains(generated_list.at(i).toLocalFile()))
+            continue;
+        addresses.prepend(generated_list.takeAt(i).toString());
+        remaining--;
+    }
+    if (!addresses.isEmpty()) emit picturesRemoved(addresses);
+}
+
+void
+Playlist::removeWatchedDirectory(const QString &path)
+{
+    if (isGenerating())
+    {
+        _queued_changes << qMakePair(Change::DirectoryRemoved,
+            QStringList(path));
+        return;
+    }
+
+    //Remove all pictures in directory
+    QString prefix = path;
+    if (!prefix.endsWith('/')) prefix += '/';
+    QStringList files;
+    foreach (QUrl url, _generated_picture_address_list)
+    {
+        QString file = url.toLocalFile();
+        if (file.startsWith(prefix)) files << file;
+    }
+    removeWatchedFiles(files);
+}
+
+void
+Playlist::regenerate()
+{
+    //Changes have been lost, scan everything again
+    generateInBackground(_generate_order);
+}
+
+void
+Playlist::receiveImportedFiles(const QStringList &files)
 {
-    int running_count = 0;
+    //Include components
+    using namespace PlaylistComponents;
+
+    //Add new files (might have been added meanwhile)
+    QStringList addresses;
+    foreach (QString file, files)
+    {
+        if (_added_picture_file_set.contains(file)) continue;
+        _added_picture_files << file;
+        _added_picture_file_set.insert(file);
+        addresses << QUrl::fromLocalFile(file).toString();
+    }
+    Importer *importer = qobject_cast<Importer*>(sender());
+    if (_import_counts.contains(importer))
+        _import_counts[importer] += addresses.size();
+    if (addresses.isEmpty()) return;
 
-    //Count running threads (excluding queued ones)
-    foreach (QThread *thread, _running_image_loaders.values())
+    //Add to list, the running scan adds them when it's done
+    if (isGenerating())
+    {
+        _scanned_picture_address_list << addresses;
+    }
+    else
     {
-        //Count if running (not just queued)
-        if (thread->isFinished()) continue; //it's 3 AM
-        if (thread->isRunning()) running_count++;
+        foreach (QString address, addresses)
+        {
+            _generated_picture_address_list << QUrl(address);
+            _generated_picture_address_set.insert(address);
+        }
     }
 
-    return running_count;
+    emit definitionChanged();
+    emit picturesAdded(addresses);
+}
+
+void
+Playlist::cleanupImport()
+{
+    //Importer thread done, delete importer
+    QThread *thread = qobject_cast<QThread*>(sender());
+    if (!thread || !_importers.contains(thread)) return;
+    PlaylistComponents::Importer *importer = _importers.take(thread);
+    int added_count = _import_counts.take(importer);
+    thread->wait();
+    delete importer;
+    thread->deleteLater();
+
+    emit importFinished(added_count);
+}
+
+void
+Playlist::cleanupWarmer()
+{
+    //Warmer thread done, delete warmer
+    QThread *thread = qobject_cast<QThread*>(sender());
+    if (!thread || !_warmers.contains(thread)) return;
+    delete _warmers.take(thread);
+    thread->wait();
+    thread->deleteLater();
+}
+
+void
+Playlist::receiveScannedPart(const QStringList &files)
+{
+    //Ignore results of old (replaced) scans
+    if (sender() != _scan) return;
+
+    //Append new pictures, announce them
+    QStringList addresses;
+    foreach (QString file, files)
+        addresses << QUrl::fromLocalFile(file).toString();
+    _scanned_picture_address_list << addresses;
+    emit picturesAdded(addresses);
+}
+
+void
+Playlist::cleanupScan()
+{
+    //Scanner thread done, delete its Scan object
+    QThread *thread = qobject_cast<QThread*>(sender());
+    if (!thread || !_scans.contains(thread)) return;
+    Scan *scan = _scans.take(thread);
+    thread->wait();
+    if (scan == _scan) _scan = 0; //canceled
+    delete scan;
+    thread->deleteLater();
 }
 
 void
@@ -152,28 +502,16 @@ Playlist::receiveImage(const QUrl &url, const QImage &image)
     //This is done AFTER the result has been forwarded!
     //Otherwise we might see identical requests coming in
     //before the first result has arrived.
-    _running_image_loaders.remove(url); //should be 1
+    _running_image_loaders.remove(url.toString());
 
-    //Queued threads waiting to be started
-    QList<QThread*> waiting_threads;
-    foreach (QThread *thread, _running_image_loaders.values())
-    {
-        //Add thread if it's not running yet
-        if (thread->isFinished()) continue; //it's 3 AM
-        if (!thread->isRunning()) waiting_threads << thread;
-    }
+}
 
-    //Start queued threads that have been waiting
-    //Prepared threads are queued and not started if too many threads running
-    foreach (QThread *thread, waiting_threads)
-    {
-        if (runningLoaderThreads() < loaderThreadLimit())
-        {
-            //Thread limit not exceeded yet
-            //Start waiting thread
-            thread->start();
-        }
-    }
+void
+Playlist::receiveThumbnail(const QUrl &url, const QImage &image)
+{
+    //Forward first, then remove from "running" queue (see receiveImage())
+    emit thumbnailLoaded(url.toString(), image);
+    _running_thumbnail_loaders.remove(url.toString());
 
 }
 
@@ -189,12 +527,15 @@ const
 
 /*!
  * Checks if the file located at given path is a valid picture.
+ * If size is defined, it is set to the dimensions of the picture.
+ *
+ * Only the header of the file is read, the picture is not decoded.
  */
 bool
-Playlist::isValidPicture(const QString &path)
+Playlist::isValidPicture(const QString &path, QSize *size)
 const
 {
-    return !QImage(path).isNull();
+    return Picture::isValid(path, size, Picture::Check::Header);
 }
 
 /*!
@@ -289,6 +630,22 @@ const
     return addresses;
 }
 
+/*!
+ * Returns the addresses of the pictures that have been found so far
+ * while the list is being generated in the background.
+ *
+ * This list only grows (see picturesAdded()) until the new list has been
+ * generated. It's empty if the list is not being generated.
+ * It's not sorted, the complete list is provided by pictureAddressList()
+ * when generated() has been emitted.
+ */
+QStringList
+Playlist::scannedPictureAddressList()
+const
+{
+    return _scanned_picture_address_list;
+}
+
 /*!
  * Loads the image at the given address and returns a QImage object.
  *
@@ -309,10 +666,38 @@ const
     //Load image (blocking)
     QVariantMap data;
     Loader loader(data);
-    loader.addUrl(address);
-    QImage image = loader.loadImages().value(address);
+    return loader.loadImage(address);
+}
 
-    return image;
+/*!
+ * Returns true if the list is being generated in the background.
+ */
+bool
+Playlist::isGenerating()
+const
+{
+    return _scan != 0;
+}
+
+/*!
+ * Returns true if picture files are being imported, see importFiles().
+ */
+bool
+Playlist::isImporting()
+const
+{
+    return !_importers.isEmpty();
+}
+
+/*!
+ * Returns true if thumbnails are being created in the background,
+ * see warmThumbnailCache().
+ */
+bool
+Playlist::isWarmingThumbnailCache()
+const
+{
+    return !_warmers.isEmpty();
 }
 
 /*!
@@ -320,13 +705,18 @@ const
  * The image will be returned by a signal: imageLoaded()
  *
  * The address should be one of the addresses in the generated list.
+ *
+ * Requests are processed by priority (see ImagePriority).
+ * Visible requests are processed last in, first out,
+ * the most recent ones are probably the ones the user is looking at.
+ * A request with a generation (not -1) can be canceled,
+ * see cancelImageRequests().
  */
 void
-Playlist::loadImageInBackground(const QUrl &address)
+Playlist::loadImageInBackground(const QUrl &address,
+                                int priority,
+                                int generation)
 {
-    //Include components
-    using namespace PlaylistComponents;
-
     //A few notes on multi-threaded loader jobs.
     //Since a request does not block the main thread,
     //20 more identical requests could arrive before
@@ -342,82 +732,71 @@ Playlist::loadImageInBackground(const QUrl &address)
     //the request had been removed from the queue.
 
     //Check if image already being loaded
-    if (_running_image_loaders.contains(address))
+    QString key = address.toString();
+    if (_running_image_loaders.contains(key))
     {
         //Already being loaded, prevent multiple identical requests
+        //If it's still queued, it might be more urgent now
+        if (_loader_pool)
+            _loader_pool->promote(address, false, priority, generation);
         return;
     }
 
     //Put it in "running" queue
     //Will be removed by receiver (slot)
-    _running_image_loaders[address] = 0;
-
-    //Create loader object and set url to be loaded
-    QVariantMap data; //runtime/session data (like username and password)
-    Loader *loader = new Loader(data);
-    loader->addUrl(address);
-
-    //Move loader to new thread
-    QThread *thread = new QThread;
-    _running_image_loaders[address] = thread;
-    loader->moveToThread(thread);
+    _running_image_loaders.insert(key);
 
-    //Start worker when thread starts
-    connect(thread,
-            SIGNAL(started()),
-            loader,
-            SLOT(process()));
+    //Foreground request, background work has to wait
+    foreach (PlaylistComponents::CacheWarmer *warmer, _warmers.values())
+        warmer->pause();
 
-    //Retrieve image when done
-    connect(loader,
-            SIGNAL(loaded(const QUrl&, const QImage&)),
-            this,
-            SLOT(receiveImage(const QUrl&, const QImage&)));
+    //Queue request
+    loaderPool()->enqueue(address, priority, generation);
 
-    //Stop thread when worker done (stops event loop)
-    connect(loader,
-            SIGNAL(finished()),
-            thread,
-            SLOT(quit()));
+}
 
-    //Delete worker when done
-    connect(loader,
-            SIGNAL(finished()),
-            loader,
-            SLOT(deleteLater()));
+/*!
+ * This is a convenience function.
+ * The address can be provided as string.
+ */
+void
+Playlist::loadImageInBackground(const QString &address,
+                                int priority,
+                                int generation)
+{
+    loadImageInBackground(QUrl(address), priority, generation);
+}
 
-    //Delete thread when thread done (event loop stopped)
-    connect(thread,
-            SIGNAL(finished()),
-            thread,
-            SLOT(deleteLater()));
-
-    //A better thread management might be necessary. TODO
-    //We can't spawn an infinite number of threads.
-    //Too many threads aren't just inefficient, they use a lot of memory.
-    //Memory usage can easily skyrocket above 1.5 GB in seconds
-    //if there are many requests coming in.
-    //This is why we use a simple form of thread management,
-    //we simply don't start more threads than the defined limit allows us.
-    //All other threads are prepared and queued but not started immediately.
-    //Whenever a thread has finished, the receiver checks if there are
-    //queued thread waiting to be started and starts some of them,
-    //always making sure the thread limit is not exceeded.
-    //This works, but it could be improved.
-    //Many requests means many threads that are constantly being
-    //created and destroyed, which is wasteful.
-    //As soon as the programmer is sufficiently annoyed by this,
-    //a more complex thread management will probably be implemented,
-    //using a pool or sub-threads (ImageLoader). Or not.
-
-    //Start thread or queue it if too many threads running
-    //Queued threads will be started by the receiveImage() slot
-    //after another thread has finished,
-    //when the number of running threads is below the threshold.
-    if (runningLoaderThreads() < loaderThreadLimit())
+/*!
+ * Loads a thumbnail of the image at the given address
+ * in a background process, scaled down to fit into max_size.
+ * The thumbnail will be returned by a signal: thumbnailLoaded()
+ *
+ * The full-size image is never decoded (see Picture::loadThumbnail()),
+ * which is a lot faster than loading the image and scaling it.
+ * Priority and generation work like in loadImageInBackground().
+ */
+void
+Playlist::loadThumbnail(const QUrl &address,
+                        const QSize &max_size,
+                        int priority,
+                        int generation)
+{
+    //Identical requests are ignored, see loadImageInBackground()
+    QString key = address.toString();
+    if (_running_thumbnail_loaders.contains(key))
     {
-        thread->start();
+        if (_loader_pool)
+            _loader_pool->promote(address, true, priority, generation);
+        return;
     }
+    _running_thumbnail_loaders.insert(key);
+    foreach (PlaylistComponents::CacheWarmer *warmer, _warmers.values())
+        warmer->pause();
+
+    //Queue request
+    QSize size = max_size.isValid() ? max_size : QSize(200, 200);
+    loaderPool()->enqueue(address, priority, generation, size);
 
 }
 
@@ -426,9 +805,38 @@ Playlist::loadImageInBackground(const QUrl &address)
  * The address can be provided as string.
  */
 void
-Playlist::loadImageInBackground(const QString &address)
+Playlist::loadThumbnail(const QString &address,
+                        const QSize &max_size,
+                        int priority,
+                        int generation)
+{
+    loadThumbnail(QUrl(address), max_size, priority, generation);
+}
+
+/*!
+ * Cancels queued image requests of an older generation than generation.
+ * Requests that are already being processed are not affected.
+ *
+ * This is meant to be called whenever a view is recreated,
+ * its old requests are obsolete.
+ */
+void
+Playlist::cancelImageRequests(int generation)
 {
-    loadImageInBackground(QUrl(address));
+    //Include components
+    using namespace PlaylistComponents;
+
+    if (!_loader_pool) return;
+
+    //Canceled requests are not running anymore, they may be requested again
+    foreach (LoaderPool::Request request, _loader_pool->cancel(generation))
+    {
+        QString key = request.url.toString();
+        if (request.max_size.isValid())
+            _running_thumbnail_loaders.remove(key);
+        else
+            _running_image_loaders.remove(key);
+    }
 }
 
 /*!
@@ -448,6 +856,7 @@ void
 Playlist::clear()
 {
     _added_picture_files.clear();
+    _added_picture_file_set.clear();
     _added_nonrecursive_dirs.clear();
     _added_recursive_dirs.clear();
 
@@ -520,10 +929,11 @@ Playlist::addFile(const QString &path)
     if (!isValidPicture(path)) return false;
 
     //Prevent duplicate
-    if (_added_picture_files.contains(path)) return false;
+    if (_added_picture_file_set.contains(path)) return false;
 
     //Add
     _added_picture_files << path;
+    _added_picture_file_set.insert(path);
 
     emit definitionChanged();
     return true;
@@ -547,31 +957,188 @@ Playlist::addFiles(const QStringList &paths)
 }
 
 /*!
- * Removes the file from the playlist.
+ * Adds a list of local picture files in the background
+ * and returns the number of files to be checked.
+ *
+ * Duplicates are dropped right away, the remaining files are checked
+ * by a pool of threads. Valid pictures are added in batches,
+ * which are announced by picturesAdded(). They're added to the
+ * generated list as well, so it doesn't have to be generated again.
+ * importProgress() is emitted every now and then,
+ * importFinished() is emitted when all files have been checked.
  */
-void
-Playlist::removeFile(const QString &path)
+int
+Playlist::importFiles(const QStringList &paths)
 {
-    //Remove file (does not have to be valid anymore)
-    if (_added_picture_files.contains(path))
+    //Include components
+    using namespace PlaylistComponents;
+
+    //Drop duplicates (already added or more than once in paths)
+    QSet<QString> known_files = _added_picture_file_set;
+    QStringList new_files;
+    foreach (QString path, paths)
     {
-        _added_picture_files.removeAll(path);
-        emit definitionChanged();
+        if (known_files.contains(path)) continue;
+        known_files.insert(path);
+        new_files << path;
+    }
+    if (new_files.isEmpty())
+    {
+        emit importFinished(0);
+        return 0;
     }
 
-}
-
-/*!
- * Adds path to playlist, if possible.
- * Returns true on success and false on error.
- * Depending on the referenced target, either a file or a directory is added.
- */
-bool
-Playlist::add(const QUrl &item)
-{
-    //Add path (probably local path)
-    //Note that remote sources are usually not defined by a
-    //simple QUrl address, but rather as an API configuration or similar.
+    //Create importer, move it to new thread
+    Importer *importer = new Importer(new_files);
+    QThread *thread = new QThread;
+    _importers[thread] = importer;
+    _import_counts[importer] = 0;
+    importer->moveToThread(thread);
+
+    //Start importer when thread starts
+    connect(thread,
+            SIGNAL(started()),
+            importer,
+            SLOT(process()));
+
+    //Forward progress
+    connect(importer,
+            SIGNAL(progress(int, int)),
+            this,
+            SIGNAL(importProgress(int, int)));
+
+    //Add valid files in batches
+    connect(importer,
+            SIGNAL(imported(const QStringList&)),
+            this,
+            SLOT(receiveImportedFiles(const QStringList&)));
+
+    //Stop thread when importer done (stops event loop)
+    connect(importer,
+            SIGNAL(finished()),
+            thread,
+            SLOT(quit()));
+
+    //Delete importer and thread when thread done (event loop stopped)
+    connect(thread,
+            SIGNAL(finished()),
+            this,
+            SLOT(cleanupImport()));
+
+    thread->start();
+    return new_files.size();
+}
+
+/*!
+ * Creates missing thumbnails (fitting into max_size)
+ * of all pictures in the generated list and stores them
+ * in the thumbnail cache (see ThumbnailCache), in the background.
+ * Nothing happens if the cache is disabled.
+ *
+ * This runs in a single thread with the lowest priority (idle),
+ * it's meant to fill the cache without being noticed.
+ * It pauses while thumbnails or images are requested
+ * and while the machine is busy.
+ */
+void
+Playlist::warmThumbnailCache(const QSize &max_size)
+{
+    //Include components
+    using namespace PlaylistComponents;
+
+    //Cache disabled or thumbnails too big
+    if (ThumbnailCache::directory().isEmpty()) return;
+    if (!ThumbnailCache::thumbnailSize(max_size)) return;
+
+    //Local files in generated list
+    QStringList files;
+    foreach (QUrl url, _generated_picture_address_list)
+    {
+        if (url.isLocalFile()) files << url.toLocalFile();
+    }
+    if (files.isEmpty()) return;
+
+    //Replace running warmer
+    stopWarmingThumbnailCache();
+
+    //Create warmer, move it to new thread
+    CacheWarmer *warmer = new CacheWarmer(files, max_size);
+    QThread *thread = new QThread;
+    _warmers[thread] = warmer;
+    warmer->moveToThread(thread);
+
+    //Start warmer when thread starts
+    connect(thread,
+            SIGNAL(started()),
+            warmer,
+            SLOT(process()));
+
+    //Stop thread when warmer done (stops event loop)
+    connect(warmer,
+            SIGNAL(finished()),
+            thread,
+            SLOT(quit()));
+
+    //Delete warmer and thread when thread done (event loop stopped)
+    connect(thread,
+            SIGNAL(finished()),
+            this,
+            SLOT(cleanupWarmer()));
+
+    //Idle priority (SCHED_IDLE on Linux)
+    thread->start(QThread::IdlePriority);
+}
+
+/*!
+ * Stops creating thumbnails in the background.
+ */
+void
+Playlist::stopWarmingThumbnailCache()
+{
+    //Not a queued call, the warmer thread is busy
+    foreach (PlaylistComponents::CacheWarmer *warmer, _warmers.values())
+        warmer->cancel();
+}
+
+/*!
+ * Cancels all running imports.
+ * Files that have already been added are kept.
+ */
+void
+Playlist::cancelImport()
+{
+    //Not a queued call, the importer thread is busy
+    foreach (PlaylistComponents::Importer *importer, _importers.values())
+        importer->cancel();
+}
+
+/*!
+ * Removes the file from the playlist.
+ */
+void
+Playlist::removeFile(const QString &path)
+{
+    //Remove file (does not have to be valid anymore)
+    if (_added_picture_file_set.contains(path))
+    {
+        _added_picture_files.removeAll(path);
+        _added_picture_file_set.remove(path);
+        emit definitionChanged();
+    }
+
+}
+
+/*!
+ * Adds path to playlist, if possible.
+ * Returns true on success and false on error.
+ * Depending on the referenced target, either a file or a directory is added.
+ */
+bool
+Playlist::add(const QUrl &item)
+{
+    //Add path (probably local path)
+    //Note that remote sources are usually not defined by a
+    //simple QUrl address, but rather as an API configuration or similar.
 
     if (item.isLocalFile())
     {
@@ -593,45 +1160,124 @@ Playlist::add(const QUrl &item)
 void
 Playlist::generate(Order order)
 {
-    QList<QUrl> &generated_list = _generated_picture_address_list; //reference
-    generated_list.clear();
-
-    //Formats
-    QStringList formats = _formats;
-
-    //Manually selected local files
-    foreach (QString file, localPictureFiles())
-    {
-        generated_list << QUrl::fromLocalFile(file);
-    }
+    //Scanner doesn't have to sort if the list is going to be sorted anyway
+    Scan::SortMode scan_sort = Scan::SortMode::Sorted;
+    if ((int)order & ((int)Order::Alphabetical | (int)Order::Random))
+        scan_sort = Scan::SortMode::Unsorted;
 
     //Non-recursive directories
-    foreach (QString dir, nonrecursiveDirectories())
-    {
-        QStringList files =
-            Scan::scan(dir, formats, Scan::RecursionMode::NonRecursive);
-        foreach (QString file, files)
-        {
-            generated_list << QUrl::fromLocalFile(file);
-        }
-    }
+    QStringList files =
+        Scan::scan(nonrecursiveDirectories(), _formats,
+            Scan::RecursionMode::NonRecursive, scan_sort);
 
     //Recursive directories
+    //All of them are scanned at once, sharing the same scanner threads
+    files << Scan::scan(recursiveDirectories(), _formats,
+        Scan::RecursionMode::Recursive, scan_sort);
+
+    setGeneratedList(files, order);
+}
+
+/*!
+ * Generates the list of pictures in a background thread.
+ *
+ * This function returns immediately, generated() is emitted
+ * when the new list is ready.
+ * In the meantime, generateProgress() is emitted every now and then
+ * and picturesAdded() is emitted whenever new pictures have been found,
+ * starting with the local picture files.
+ * A generate request that's still running is canceled.
+ */
+void
+Playlist::generateInBackground(Order order)
+{
+    //Cancel running scan, its result would be obsolete
+    //The new scan sees the changes reported so far
+    _queued_changes.clear();
+    cancelGenerate();
+
+    //Scanner doesn't have to sort if the list is going to be sorted anyway
+    Scan::SortMode scan_sort = Scan::SortMode::Sorted;
+    if ((int)order & ((int)Order::Alphabetical | (int)Order::Random))
+        scan_sort = Scan::SortMode::Unsorted;
+
+    //Define scan
+    Scan *scan = new Scan(QStringList(), _formats);
+    foreach (QString dir, nonrecursiveDirectories())
+        scan->addPath(dir, Scan::RecursionMode::NonRecursive);
     foreach (QString dir, recursiveDirectories())
-    {
-        QStringList files =
-            Scan::scan(dir, formats, Scan::RecursionMode::Recursive);
-        foreach (QString file, files)
-        {
-            generated_list << QUrl::fromLocalFile(file);
-        }
-    }
+        scan->addPath(dir, Scan::RecursionMode::Recursive);
+    scan->setSortMode(scan_sort);
+    _scan = scan;
+    _generate_order = order;
 
-    //Sort
-    if (order != Order::None)
-        sort(order);
+    //Local picture files come first, no need to scan for them
+    _scanned_picture_address_list.clear();
+    foreach (QString file, localPictureFiles())
+        _scanned_picture_address_list << QUrl::fromLocalFile(file).toString();
+    if (!_scanned_picture_address_list.isEmpty())
+        emit picturesAdded(_scanned_picture_address_list);
 
-    emit generated();
+    //Move scan to new thread
+    QThread *thread = new QThread;
+    _scans[thread] = scan;
+    scan->moveToThread(thread);
+
+    //Start scan when thread starts
+    connect(thread,
+            SIGNAL(started()),
+            scan,
+            SLOT(process()));
+
+    //Forward progress
+    connect(scan,
+            SIGNAL(progress(int, int)),
+            this,
+            SIGNAL(generateProgress(int, int)));
+
+    //Retrieve new files as they're found
+    connect(scan,
+            SIGNAL(found(const QStringList&)),
+            this,
+            SLOT(receiveScannedPart(const QStringList&)));
+
+    //Retrieve list when done
+    connect(scan,
+            SIGNAL(scanned(const QStringList&)),
+            this,
+            SLOT(receiveScan(const QStringList&)));
+
+    //Stop thread when scan done (stops event loop)
+    connect(scan,
+            SIGNAL(finished()),
+            thread,
+            SLOT(quit()));
+
+    //Delete scan and thread when thread done (event loop stopped)
+    connect(thread,
+            SIGNAL(finished()),
+            this,
+            SLOT(cleanupScan()));
+
+    thread->start();
+}
+
+/*!
+ * Cancels the list being generated in the background, if any.
+ * The old list remains, generated() is not emitted.
+ */
+void
+Playlist::cancelGenerate()
+{
+    if (!_scan) return;
+
+    //Not a queued call, the scan thread is busy
+    _scan->cancel();
+    _scan = 0;
+    _scanned_picture_address_list.clear();
+
+    //The old list is kept, it's still being watched
+    applyQueuedChanges();
 }
 
 /*!
@@ -683,68 +1329,525 @@ PlaylistComponents::Loader::Loader(const QVariantMap &runtime_data)
 {
 }
 
-QMap<QUrl, QImage>
-PlaylistComponents::Loader::loadImages()
+QImage
+PlaylistComponents::Loader::loadImage(const QUrl &url)
+{
+    //Fetch url and return image
+    //Any kind of session data that might be required to access this url
+    //would be stored in this object. So this could not be a free function.
+
+    //Load image with given address
+    QImage image;
+    if (url.isLocalFile())
+    {
+        //Local file
+        image = QImage(url.toLocalFile());
+    }
+    //TODO support other sources
+
+    return image;
+}
+
+QImage
+PlaylistComponents::Loader::loadThumbnail(const QUrl &url,
+                                          const QSize &max_size)
+{
+    //Load scaled image (decoded in thumbnail size or from disk cache)
+    QImage image;
+    if (url.isLocalFile())
+    {
+        //Local file
+        QString path = url.toLocalFile();
+        image = ThumbnailCache::loadThumbnail(path, max_size);
+
+        //Remember average color, shown while the thumbnail is loading
+        //(next time), it's computed from the decoded pixels (no I/O)
+        ScanIndex *index = Scan::index();
+        if (index && !image.isNull())
+            index->setColor(path, Picture::averageColor(image));
+    }
+    //TODO support other sources
+
+    return image;
+}
+
+/*! \class PlaylistComponents::LoaderPool
+ *
+ * \brief The LoaderPool class loads images in a fixed number of threads.
+ *
+ * Requests are queued by priority (see Playlist::ImagePriority).
+ * Visible requests are taken last in, first out,
+ * the other ones first in, first out.
+ * Queued requests with a generation can be canceled (see cancel()).
+ * Requests with a maximum size are thumbnail requests,
+ * which are returned by thumbnailLoaded() instead of loaded().
+ * Threads are started when they're needed (no idle thread available),
+ * up to the defined maximum, and they keep running
+ * until the pool is destroyed, waiting for the next request.
+ *
+ */
+
+PlaylistComponents::LoaderPool::LoaderPool(const QVariantMap &runtime_data,
+                                           int threads,
+                                           QObject *parent)
+                      : QObject(parent),
+                        _runtime_data(runtime_data),
+                        _max_threads(threads),
+                        _idle_threads(0),
+                        _stopping(false)
 {
-    //List of urls to be loaded
-    QList<QUrl> urls = _urls_to_be_loaded;
+    if (_max_threads < 1) _max_threads = 1;
+}
 
-    //Load images (return them all at once)
-    QMap<QUrl, QImage> url_image_map;
-    foreach (QUrl url, urls)
+PlaylistComponents::LoaderPool::~LoaderPool()
+{
+    //Stop threads (after the current request)
+    {
+        QMutexLocker locker(&_mutex);
+        _stopping = true;
+        _visible_requests.clear();
+        _prefetch_requests.clear();
+        _background_requests.clear();
+        _condition.wakeAll();
+    }
+    foreach (LoaderThread *thread, _threads)
     {
-        QImage image = loadImage(url);
-        url_image_map[url] = image;
+        thread->wait();
+        delete thread;
     }
+}
 
-    return url_image_map;
+int
+PlaylistComponents::LoaderPool::maximumThreadCount()
+const
+{
+    return _max_threads;
 }
 
+int
+PlaylistComponents::LoaderPool::queuedCount()
+const
+{
+    QMutexLocker locker(&_mutex);
+    return queueSize();
+}
+
+/*!
+ * Moves the queued request for url (thumbnail or image)
+ * up to the given priority, unless its priority is higher already;
+ * it's kept in place then, but it belongs to generation now.
+ * Returns false if it's not queued (anymore).
+ *
+ * This is a linear search, but only through the queue.
+ */
 bool
-PlaylistComponents::Loader::addUrl(const QUrl &url)
+PlaylistComponents::LoaderPool::promote(const QUrl &url,
+                                        bool thumbnail,
+                                        int priority,
+                                        int generation)
+{
+    QMutexLocker locker(&_mutex);
+
+    //Queues, most urgent first (index is the priority)
+    QList<QList<Request>*> queues;
+    queues << &_visible_requests << &_prefetch_requests
+           << &_background_requests;
+    int level = qBound(0, priority, queues.size() - 1);
+
+    for (int q = 0, qq = queues.size(); q < qq; q++)
+    {
+        QList<Request> &queue = *queues.at(q); //reference
+        for (int i = 0, ii = queue.size(); i < ii; i++)
+        {
+            const Request &queued = queue.at(i);
+            if (queued.url != url || queued.max_size.isValid() != thumbnail)
+                continue;
+
+            //Higher priority already, leave it there
+            if (q < level)
+            {
+                queue[i].generation = generation;
+                return true;
+            }
+
+            //Queue it again, as new request
+            //Visible requests are taken from the end, the others from the
+            //front, so appending makes it the newest one either way
+            Request request = queue.takeAt(i);
+            request.generation = generation;
+            queues.at(level)->append(request);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * Removes queued requests of a generation older than generation
+ * (requests without generation are kept) and returns them.
+ */
+QList<PlaylistComponents::LoaderPool::Request>
+PlaylistComponents::LoaderPool::cancel(int generation)
+{
+    QMutexLocker locker(&_mutex);
+    QList<Request> canceled_requests;
+
+    //Visible and prefetch requests (background requests are not canceled)
+    QList<QList<Request>*> queues;
+    queues << &_visible_requests << &_prefetch_requests;
+    foreach (QList<Request> *queue, queues)
+    {
+        QList<Request> kept_requests;
+        foreach (Request request, *queue)
+        {
+            if (request.generation != -1 && request.generation < generation)
+                canceled_requests << request;
+            else
+                kept_requests << request;
+        }
+        *queue = kept_requests;
+    }
+
+    return canceled_requests;
+}
+
+/*!
+ * Queues a request for the image at url.
+ * If max_size is valid, a thumbnail of that size is loaded instead.
+ */
+void
+PlaylistComponents::LoaderPool::enqueue(const QUrl &url,
+                                        int priority,
+                                        int generation,
+                                        const QSize &max_size)
+{
+    typedef Playlist::ImagePriority ImagePriority;
+    QMutexLocker locker(&_mutex);
+
+    Request request;
+    request.url = url;
+    request.max_size = max_size;
+    request.generation = generation;
+    if (priority == (int)ImagePriority::Visible)
+        _visible_requests << request; //taken from the end
+    else if (priority == (int)ImagePriority::Prefetch)
+        _prefetch_requests.enqueue(request);
+    else
+        _background_requests.enqueue(request);
+
+    //Wake up idle thread, start another one if there are more requests
+    if (_idle_threads) _condition.wakeOne();
+    if (queueSize() > _idle_threads && _threads.size() < _max_threads)
+    {
+        LoaderThread *thread = new LoaderThread(this);
+        _threads << thread;
+        thread->start();
+    }
+}
+
+void
+PlaylistComponents::LoaderPool::work()
 {
-    //Check url
-    if (url.isEmpty()) return false;
+    //Include components
+    using namespace PlaylistComponents;
 
-    //Add url
-    _urls_to_be_loaded << url;
+    //Each thread has its own loader (which isn't thread-safe)
+    Loader loader(_runtime_data);
 
+    forever
+    {
+        //Wait for next request
+        Request request;
+        {
+            QMutexLocker locker(&_mutex);
+            while (!take(request) && !_stopping)
+            {
+                _idle_threads++;
+                _condition.wait(&_mutex);
+                _idle_threads--;
+            }
+            if (_stopping) break;
+        }
+
+        //Load image, send it to the playlist (in its thread)
+        if (request.max_size.isValid())
+        {
+            QImage image = loader.loadThumbnail(request.url, request.max_size);
+            emit thumbnailLoaded(request.url, image);
+        }
+        else
+        {
+            QImage image = loader.loadImage(request.url);
+            emit loaded(request.url, image);
+        }
+    }
+}
+
+int
+PlaylistComponents::LoaderPool::queueSize()
+const
+{
+    //Called with _mutex locked
+    return _visible_requests.size() + _prefetch_requests.size() +
+        _background_requests.size();
+}
+
+bool
+PlaylistComponents::LoaderPool::take(Request &request)
+{
+    //Called with _mutex locked
+    //Highest priority first, visible ones last in, first out
+    if (!_visible_requests.isEmpty())
+        request = _visible_requests.takeLast();
+    else if (!_prefetch_requests.isEmpty())
+        request = _prefetch_requests.dequeue();
+    else if (!_background_requests.isEmpty())
+        request = _background_requests.dequeue();
+    else
+        return false;
     return true;
 }
 
+PlaylistComponents::LoaderThread::LoaderThread(LoaderPool *pool)
+                        : _pool(pool)
+{
+}
+
 void
-PlaylistComponents::Loader::process()
+PlaylistComponents::LoaderThread::run()
+{
+    _pool->work();
+}
+
+PlaylistComponents::Importer::Importer(const QStringList &paths)
+                    : _paths(paths),
+                      _next(0),
+                      _checked(0),
+                      _canceled(0)
 {
-    //List of urls to be loaded
-    QList<QUrl> urls = _urls_to_be_loaded;
+}
+
+bool
+PlaylistComponents::Importer::isCanceled()
+const
+{
+    return _canceled != 0;
+}
 
-    //Load images one by one (return one by one, 21st century style)
-    foreach (QUrl url, urls)
+void
+PlaylistComponents::Importer::work()
+{
+    //Check files, one at a time, until none are left
+    //Threads take the next file from the same list, no need to split it
+    int total = _paths.size();
+    forever
     {
-        QImage image = loadImage(url);
-        emit loaded(url, image);
+        int i = _next.fetchAndAddOrdered(1);
+        if (i >= total || isCanceled()) break;
+        QString path = _paths.at(i);
+
+        //Check file (header only)
+        bool valid = QFileInfo(path).isFile() && Picture::isValid(path);
+
+        //Add to batch
+        _checked.fetchAndAddOrdered(1);
+        QMutexLocker locker(&_batch_mutex);
+        if (valid) _batch << path;
+        if (_batch_timer.elapsed() >= 100) report();
+    }
+}
+
+void
+PlaylistComponents::Importer::process()
+{
+    //Include components
+    using namespace PlaylistComponents;
+
+    //Start workers, this thread is a worker too
+    //Reading a file header is mostly waiting for the disk
+    int threads = QThread::idealThreadCount() * 2;
+    if (threads < 1) threads = 1;
+    if (threads > _paths.size()) threads = _paths.size();
+    _batch_timer.start();
+    QList<ImportWorker*> workers;
+    for (int i = 1; i < threads; i++)
+    {
+        ImportWorker *worker = new ImportWorker(this);
+        workers << worker;
+        worker->start();
+    }
+    work();
+    foreach (ImportWorker *worker, workers)
+    {
+        worker->wait();
+        delete worker;
+    }
+
+    //Remaining files
+    {
+        QMutexLocker locker(&_batch_mutex);
+        report();
     }
 
-    //Done
     emit finished();
 }
 
-QImage
-PlaylistComponents::Loader::loadImage(const QUrl &url)
+void
+PlaylistComponents::Importer::cancel()
 {
-    //Fetch url and return image
-    //Any kind of session data that might be required to access this url
-    //would be stored in this object. So this could not be a free function.
+    _canceled.fetchAndStoreOrdered(1);
+}
 
-    //Load image with given address
-    QImage image;
-    if (url.isLocalFile())
+void
+PlaylistComponents::Importer::report()
+{
+    //Called with _batch_mutex locked
+    if (isCanceled()) return;
+    if (!_batch.isEmpty())
     {
-        //Local file
-        image = QImage(url.toLocalFile());
+        emit imported(_batch);
+        _batch.clear();
     }
-    //TODO support other sources
+    emit progress(_checked.fetchAndAddOrdered(0), _paths.size());
+    _batch_timer.restart();
+}
 
-    return image;
+/*! \class PlaylistComponents::CacheWarmer
+ *
+ * \brief The CacheWarmer class creates missing thumbnails
+ * in the thumbnail cache.
+ *
+ * It's meant to run in a thread with idle priority.
+ * I/O priority is set to idle too (Linux).
+ * After each thumbnail, it sleeps at least as long as it took
+ * to create it (at least 100 ms), so it never takes more than half
+ * of a core. It waits while the gui requests images (see pause())
+ * and while the machine is busy (load average above number of cores).
+ *
+ */
+
+PlaylistComponents::CacheWarmer::CacheWarmer(const QStringList &files,
+                                             const QSize &max_size)
+                       : _files(files),
+                         _max_size(max_size),
+                         _canceled(0),
+                         _created(0)
+{
+    //Not started yet, isPaused() checks isValid() (undefined in Qt 4)
+    _foreground_timer.invalidate();
 }
 
+bool
+PlaylistComponents::CacheWarmer::isCanceled()
+const
+{
+    return _canceled != 0;
+}
+
+/*!
+ * Returns the number of thumbnails that have been created.
+ */
+int
+PlaylistComponents::CacheWarmer::createdCount()
+const
+{
+    return _created;
+}
+
+/*!
+ * Pauses for a few seconds, because there's foreground work.
+ * Called whenever an image is requested.
+ */
+void
+PlaylistComponents::CacheWarmer::pause()
+{
+    QMutexLocker locker(&_mutex);
+    _foreground_timer.start();
+}
+
+void
+PlaylistComponents::CacheWarmer::process()
+{
+    //Idle I/O priority for this thread (IOPRIO_CLASS_IDLE)
+    #if defined(__linux__)
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13); //IOPRIO_WHO_PROCESS, self
+    #endif
+
+    foreach (QString path, _files)
+    {
+        //Wait while there's foreground work or the machine is busy
+        while (!isCanceled() && (isPaused() || isBusy()))
+            sleep(1000);
+        if (isCanceled()) break;
+
+        //Create thumbnail (unless there's a valid one)
+        if (ThumbnailCache::contains(path, _max_size)) continue;
+        QElapsedTimer timer;
+        timer.start();
+        ThumbnailCache::create(path, _max_size);
+        _created.ref();
+
+        //Rate limit
+        if (!sleep(qMax<qint64>(100, timer.elapsed()))) break;
+    }
+
+    emit finished();
+}
+
+/*!
+ * Stops creating thumbnails (after the current one).
+ */
+void
+PlaylistComponents::CacheWarmer::cancel()
+{
+    QMutexLocker locker(&_mutex);
+    _canceled.fetchAndStoreOrdered(1);
+    _condition.wakeAll();
+}
+
+bool
+PlaylistComponents::CacheWarmer::sleep(int ms)
+{
+    //Sleep, unless canceled, return false if canceled
+    QMutexLocker locker(&_mutex);
+    if (!isCanceled()) _condition.wait(&_mutex, ms);
+    return !isCanceled();
+}
+
+bool
+PlaylistComponents::CacheWarmer::isPaused()
+const
+{
+    //Foreground request in the last few seconds
+    QMutexLocker locker(&_mutex);
+    return _foreground_timer.isValid() && _foreground_timer.elapsed() < 3000;
+}
+
+bool
+PlaylistComponents::CacheWarmer::isBusy()
+const
+{
+    //Load average (1 min) higher than number of cores
+    bool busy = false;
+    #if defined(__linux__)
+    QFile file("/proc/loadavg");
+    if (file.open(QIODevice::ReadOnly))
+    {
+        double load = QString(file.readLine()).section(' ', 0, 0).toDouble();
+        busy = load > qMax(QThread::idealThreadCount(), 1);
+    }
+    #endif
+    return busy;
+}
+
+PlaylistComponents::ImportWorker::ImportWorker(Importer *importer)
+                        : _importer(importer)
+{
+}
+
+void
+PlaylistComponents::ImportWorker::run()
+{
+    _importer->work();
+}
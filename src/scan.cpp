@@ -1,53 +1,484 @@
 #include "scan.hpp"
+#include "scanindex.hpp"
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <cstring>
+#endif
+
+/*! \class Scan
+ *
+ * \brief The Scan class collects files from one or more directories.
+ *
+ * The static scan() functions block until the whole tree has been scanned.
+ * Recursive scans are handed to a pool of worker threads
+ * (see ScanComponents::Walker), non-recursive scans simply list
+ * the directory in the calling thread.
+ *
+ * The order of the returned list does not depend on the number of threads.
+ * Each directory contributes its files (sorted by name),
+ * followed by the files in its subdirectories (sorted by name, recursively).
+ * If the order doesn't matter (because the caller sorts the list anyway),
+ * SortMode::Unsorted can be used to skip sorting.
+ *
+ * A Scan object can also be moved to another thread, see process().
+ * It emits the files it finds in batches (found()), as soon as possible,
+ * so the first results can be shown while the scan is still running.
+ *
+ * On Linux, directories are read directly (see readNative()).
+ * Other platforms use QDir.
+ * If an index is defined (see setIndex()), directories that
+ * have not been modified since they've been read are not read again.
+ *
+ * Directories are identified by device and inode number
+ * (see directoryId()), not by their path.
+ * A directory that's reachable through a symlink or a bind mount
+ * is only scanned once and a symlink pointing to a parent directory
+ * does not lead to an infinite loop.
+ *
+ */
+
+int Scan::_concurrency = 0;
+
+ScanIndex* Scan::_index = 0;
+
+#if defined(__linux__)
+static bool
+lessThanIgnoreCase(const QString &a, const QString &b)
+{
+    return a.compare(b, Qt::CaseInsensitive) < 0;
+}
+#endif
 
 QStringList
 Scan::scan(const QString &path,
            const QStringList &filters,
-           RecursionMode recursive)
+           RecursionMode recursive,
+           SortMode sort)
 {
-    QStringList scanned_dirs;
-    return scan(path, filters, recursive, scanned_dirs);
+    return scan(QStringList() << path, filters, recursive, sort);
 }
 
 QStringList
 Scan::scan(const QStringList &paths,
            const QStringList &filters,
-           RecursionMode recursive)
+           RecursionMode recursive,
+           SortMode sort)
 {
+    //Include components
+    using namespace ScanComponents;
+
     QStringList result_list;
-    foreach (QString path, paths)
-        result_list << scan(path, filters, recursive);
+
+    //Non-recursive, one listing per directory, no threads involved
+    if (recursive == RecursionMode::NonRecursive)
+    {
+        foreach (QString path, paths)
+        {
+            if (path.isEmpty()) continue;
+            QStringList files, dirs;
+            list(path, filters, files, dirs, sort);
+            result_list << files;
+        }
+        return result_list;
+    }
+
+    //Recursive, all paths share the same pool of workers
+    Walker walker(filters, concurrency(), sort);
+    result_list = walker.walk(paths);
+
     return result_list;
 }
 
+/*!
+ * Returns the number of threads used for recursive scans.
+ *
+ * Unless defined otherwise, this is twice the number of cores,
+ * because scanning a directory tree is mostly waiting for the disk
+ * (or the network, if the pictures are on a NAS).
+ */
+int
+Scan::concurrency()
+{
+    int threads = _concurrency;
+    if (threads < 1) threads = QThread::idealThreadCount() * 2;
+    if (threads < 1) threads = 1;
+    return threads;
+}
+
+/*!
+ * Sets the number of threads used for recursive scans.
+ * 0 restores the default, 1 scans in the calling thread only.
+ */
+void
+Scan::setConcurrency(int threads)
+{
+    if (threads < 0) threads = 0;
+    _concurrency = threads;
+}
+
+/*!
+ * Returns the index used to skip unchanged directories, 0 if none.
+ */
+ScanIndex*
+Scan::index()
+{
+    return _index;
+}
+
+/*!
+ * Sets the index used to skip unchanged directories (0 to disable it).
+ * This is shared by all scans, it must not be changed while scanning.
+ * The ownership of index is not transferred.
+ */
+void
+Scan::setIndex(ScanIndex *index)
+{
+    _index = index;
+}
+
+/*!
+ * Lists the directory at path.
+ * Files matching filters are added to files,
+ * subdirectories are added to dirs, both sorted by name
+ * unless sort is SortMode::Unsorted.
+ */
+void
+Scan::list(const QString &path,
+           const QStringList &filters,
+           QStringList &files,
+           QStringList &dirs,
+           SortMode sort)
+{
+    QStringList file_names;
+    QStringList dir_names;
+    read(path, filters, file_names, dir_names, 0, sort);
+
+    //Full paths
+    QString prefix = path;
+    if (!prefix.endsWith('/')) prefix += '/';
+    foreach (QString name, file_names)
+        files << prefix + name;
+    foreach (QString name, dir_names)
+        dirs << prefix + name;
+
+}
+
+/*!
+ * Returns the identifier of the directory at path.
+ *
+ * This is the device and inode number of the directory
+ * (symlinks are resolved), so two paths pointing to the same directory
+ * have the same identifier.
+ * If there is no inode number (Windows), the canonical path is used.
+ */
+ScanComponents::DirectoryId
+Scan::directoryId(const QString &path)
+{
+    ScanComponents::DirectoryId id;
+
+    #if !defined(_WIN32)
+    struct stat st;
+    if (!stat(QFile::encodeName(path).constData(), &st))
+    {
+        id.device = st.st_dev;
+        id.inode = st.st_ino;
+        return id;
+    }
+    #endif
+
+    id.path = QFileInfo(path).canonicalFilePath();
+    if (id.path.isEmpty()) id.path = path; //not found
+    return id;
+}
+
+void
+Scan::read(const QString &path,
+           const QStringList &filters,
+           QStringList &file_names,
+           QStringList &dir_names,
+           QList<ScanComponents::DirectoryId> *dir_ids,
+           SortMode sort)
+{
+    if (path.isEmpty()) return;
+
+    //Unchanged directory, listing taken from index
+    //Listings in the index are sorted, they're shared by all callers
+    //Subdirectories are identified again, ids are not kept in the index
+    //(device numbers change when filesystems are mounted again)
+    ScanIndex *index = _index;
+    qint64 mtime = -1;
+    if (index)
+    {
+        mtime = ScanIndex::modificationTime(path);
+        int first_dir = dir_names.size();
+        if (index->lookup(path, filters, mtime, file_names, dir_names))
+        {
+            for (int i = first_dir; dir_ids && i < dir_names.size(); i++)
+                *dir_ids << directoryId(path + '/' + dir_names.at(i));
+            return;
+        }
+        sort = SortMode::Sorted;
+    }
+
+    //Fast path (not available on all platforms, not for all filters)
+    //Portable fallback
+    if (!readNative(path, filters, file_names, dir_names, dir_ids, sort))
+        readPortable(path, filters, file_names, dir_names, dir_ids, sort);
+
+    //Remember listing
+    if (index)
+        index->insert(path, filters, mtime, file_names, dir_names);
+
+}
+
+/*!
+ * Reads the directory at path directly, returns false if this is
+ * not possible. Only names are returned, without the path.
+ * If dir_ids is defined, the identifiers of the subdirectories
+ * are added to it (same order as dir_names).
+ *
+ * QDir stats every entry (twice, if it's a symlink),
+ * creates a QFileInfo for each one and sorts the list.
+ * In a directory with 50k pictures, this takes much longer
+ * than reading the directory itself.
+ * Here, the directory is read once (readdir() uses getdents64 internally)
+ * and the type reported with each entry (d_type) is used to tell
+ * files from directories. Only symlinks, entries of unknown type
+ * (some filesystems don't provide d_type) and subdirectories are stat'ed.
+ * Filters are matched as extensions on the raw file name,
+ * so names are only decoded if they're actually used.
+ *
+ * Only simple filters like "*.jpg" are supported (case-insensitive,
+ * like QDir), other patterns are left to the portable implementation.
+ */
+bool
+Scan::readNative(const QString &path,
+                 const QStringList &filters,
+                 QStringList &file_names,
+                 QStringList &dir_names,
+                 QList<ScanComponents::DirectoryId> *dir_ids,
+                 SortMode sort)
+{
+    #if defined(__linux__)
+
+    //Extensions (".jpg"), anything but "*.ext" is not supported here
+    QList<QByteArray> extensions;
+    foreach (QString filter, filters)
+    {
+        if (!filter.startsWith("*.")) return false;
+        QByteArray extension = QFile::encodeName(filter.mid(1).toLower());
+        if (extension.contains('*') || extension.contains('?') ||
+            extension.contains('['))
+            return false;
+        extensions << extension;
+    }
+
+    //Open directory
+    DIR *dir = opendir(QFile::encodeName(path).constData());
+    if (!dir) return true; //not readable, nothing in it (for us)
+    int fd = dirfd(dir);
+
+    //Read entries
+    QStringList new_file_names;
+    QStringList new_dir_names;
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        const char *name = entry->d_name;
+        if (name[0] == '.' &&
+            (!name[1] || (name[1] == '.' && !name[2])))
+            continue; //"." and ".."
+
+        //Determine type, stat only if necessary
+        //Symlinks are followed, like QFileInfo does
+        int type = entry->d_type;
+        if (type == DT_LNK || type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (fstatat(fd, name, &st, 0)) continue; //broken link
+            if (S_ISREG(st.st_mode)) type = DT_REG;
+            else if (S_ISDIR(st.st_mode)) type = DT_DIR;
+            else continue;
+        }
+
+        //Directory
+        if (type == DT_DIR)
+        {
+            new_dir_names << QFile::decodeName(name);
+            continue;
+        }
+        if (type != DT_REG) continue; //fifo, socket, device...
+
+        //File, check extension
+        bool match = extensions.isEmpty();
+        int length = strlen(name);
+        foreach (const QByteArray &extension, extensions)
+        {
+            int extension_length = extension.size();
+            if (length < extension_length) continue;
+            if (qstrnicmp(name + length - extension_length,
+                extension.constData(), extension_length))
+                continue;
+            match = true;
+            break;
+        }
+        if (match) new_file_names << QFile::decodeName(name);
+    }
+
+    //Sort by name (like QDir)
+    if (sort == SortMode::Sorted)
+    {
+        qSort(new_file_names.begin(), new_file_names.end(),
+            lessThanIgnoreCase);
+        qSort(new_dir_names.begin(), new_dir_names.end(),
+            lessThanIgnoreCase);
+    }
+
+    //Identify subdirectories (symlinks resolved)
+    if (dir_ids)
+    {
+        foreach (QString name, new_dir_names)
+        {
+            ScanComponents::DirectoryId dir_id;
+            struct stat st;
+            if (!fstatat(fd, QFile::encodeName(name).constData(), &st, 0))
+            {
+                dir_id.device = st.st_dev;
+                dir_id.inode = st.st_ino;
+            }
+            else
+            {
+                dir_id.path = path + '/' + name; //gone
+            }
+            *dir_ids << dir_id;
+        }
+    }
+    closedir(dir);
+
+    file_names << new_file_names;
+    dir_names << new_dir_names;
+    return true;
+
+    #else
+
+    return false;
+
+    #endif
+}
+
+/*!
+ * Reads the directory at path using QDir.
+ */
+void
+Scan::readPortable(const QString &path,
+                   const QStringList &filters,
+                   QStringList &file_names,
+                   QStringList &dir_names,
+                   QList<ScanComponents::DirectoryId> *dir_ids,
+                   SortMode sort)
+{
+    QDir::Filters flags;
+    flags = QDir::AllEntries; //Files + Directories
+    flags |= QDir::NoDotAndDotDot;
+    flags |= QDir::Hidden;
+    flags |= QDir::System;
+    QDir::SortFlags sort_flags = QDir::Name | QDir::IgnoreCase;
+    if (sort == SortMode::Unsorted) sort_flags = QDir::Unsorted;
+    QDir dir(path);
+    //One listing, filters are matched below
+    //"*.jpg" filter -> no directories (well, except "dir.jpg" maybe)
+    QFileInfoList entries = dir.entryInfoList(flags, sort_flags);
+    //The entry list contains both files and directories
+    //(as well as other file types, which are eventually ignored).
+
+    foreach (QFileInfo info, entries)
+    {
+        if (info.isFile())
+        {
+            //Add file (if it matches)
+            if (filters.isEmpty() || QDir::match(filters, info.fileName()))
+                file_names << info.fileName();
+        }
+        else if (info.isDir())
+        {
+            //Add directory
+            dir_names << info.fileName();
+            if (dir_ids) *dir_ids << directoryId(info.filePath());
+        }
+    }
+
+}
+
 Scan::Scan(const QStringList &paths, const QStringList &filter)
+    : _sort(SortMode::Sorted),
+      _canceled(0)
 {
     setPath(paths);
     setFilter(filter);
 }
 
 Scan::Scan(const QString &path, const QStringList &filter)
+    : _sort(SortMode::Sorted),
+      _canceled(0)
 {
     setPath(path);
     setFilter(filter);
 }
 
 Scan::Scan(const QString &path)
+    : _sort(SortMode::Sorted),
+      _canceled(0)
 {
     setPath(path);
 }
 
+/*!
+ * Returns true if this scan has been canceled.
+ */
+bool
+Scan::isCanceled()
+const
+{
+    return _canceled != 0;
+}
+
+/*!
+ * Sets the directories to be scanned (recursively) by process().
+ */
 void
 Scan::setPath(const QStringList &paths)
 {
-    _paths = paths;
+    _paths.clear();
+    _recursion.clear();
+    foreach (QString path, paths)
+        addPath(path, RecursionMode::Recursive);
 }
 
+/*!
+ * Sets the directory to be scanned (recursively) by process().
+ */
 void
 Scan::setPath(const QString &path)
 {
-    _paths.clear();
+    setPath(QStringList() << path);
+}
+
+/*!
+ * Adds a directory to be scanned by process().
+ *
+ * Directories that are not scanned recursively come first
+ * in the scanned list, followed by the recursive ones.
+ */
+void
+Scan::addPath(const QString &path, RecursionMode recursive)
+{
     _paths << path;
+    _recursion << recursive;
 }
 
 void
@@ -56,79 +487,414 @@ Scan::setFilter(const QStringList &filter)
     _typefilter = filter;
 }
 
+/*!
+ * Sets the sort mode used by process().
+ */
+void
+Scan::setSortMode(SortMode sort)
+{
+    _sort = sort;
+}
+
+/*!
+ * Scans the defined directories and emits scanned() with the result,
+ * followed by finished().
+ *
+ * This is meant to be run in a separate thread.
+ * The progress() signal is emitted every now and then
+ * while the scan is running.
+ * New files are emitted in batches by found(), in no particular order.
+ * The list emitted by scanned() contains all of them, in order.
+ * If the scan is canceled, scanned() is not emitted.
+ */
 void
 Scan::process()
 {
+    //Include components
+    using namespace ScanComponents;
+
     QStringList list;
-    list = scan(paths(), filter(), RecursionMode::Recursive);
-    emit scanned(list);
+    QStringList paths = this->paths();
+    QStringList recursive_paths;
+    int directory_count = 0;
+    int file_count = 0;
+
+    //Non-recursive directories first
+    for (int i = 0, ii = paths.size(); i < ii && !isCanceled(); i++)
+    {
+        if (_recursion.value(i) == RecursionMode::Recursive)
+        {
+            recursive_paths << paths.at(i);
+            continue;
+        }
+        QStringList files, dirs;
+        Scan::list(paths.at(i), filter(), files, dirs, _sort);
+        list << files;
+        directory_count++;
+        file_count += files.size();
+        if (!files.isEmpty()) reportFound(files);
+        reportProgress(directory_count, file_count);
+    }
+
+    //Recursive directories
+    if (!recursive_paths.isEmpty() && !isCanceled())
+    {
+        Walker walker(filter(), concurrency(), _sort);
+        walker.setObserver(this, directory_count, file_count);
+        list << walker.walk(recursive_paths);
+    }
+
+    if (!isCanceled()) emit scanned(list);
     emit finished();
 }
 
+/*!
+ * Cancels the running scan.
+ *
+ * This function is thread-safe, it's meant to be called directly
+ * from another thread (a queued call would only arrive after the scan).
+ */
+void
+Scan::cancel()
+{
+    _canceled.fetchAndStoreOrdered(1);
+}
+
 QStringList
-Scan::scan(const QString &path,
-           const QStringList &filters,
-           RecursionMode recursive,
-           QStringList &scanned_dirs)
+Scan::paths()
+{
+    return _paths;
+}
+
+QStringList
+Scan::filter()
+{
+    return _typefilter;
+}
+
+void
+Scan::reportProgress(int directories, int files)
+{
+    emit progress(directories, files);
+}
+
+void
+Scan::reportFound(const QStringList &files)
+{
+    emit found(files);
+}
+
+ScanComponents::DirectoryId::DirectoryId()
+                           : device(0),
+                             inode(0)
+{
+}
+
+bool
+ScanComponents::DirectoryId::operator==(const DirectoryId &other)
+const
+{
+    return device == other.device &&
+           inode == other.inode &&
+           path == other.path;
+}
+
+uint
+ScanComponents::qHash(const DirectoryId &id)
+{
+    return ::qHash(id.inode) ^ ::qHash(id.device) ^ ::qHash(id.path);
+}
+
+/*! \class ScanComponents::Walker
+ *
+ * \brief The Walker scans directory trees using a pool of threads.
+ *
+ * Every worker owns a queue of directories waiting to be listed.
+ * Subdirectories found by a worker are put in its own queue
+ * and taken from the back (depth first, good for the disk cache).
+ * A worker that runs out of directories steals one from the front
+ * of another worker's queue, which is usually a big chunk of work
+ * near the top of the tree.
+ *
+ * Every directory is claimed in a hash table, keyed by its identifier
+ * (device and inode), before it's queued.
+ * A directory that has already been claimed, because it has been found
+ * through another path, is not listed again.
+ *
+ * The listings only contain names, they don't depend on the path
+ * that was used to reach a directory.
+ * Once everything has been listed, the tree is walked in order,
+ * which is why the result does not depend on which worker
+ * happened to list which directory (first path wins).
+ *
+ */
+
+ScanComponents::Walker::Walker(const QStringList &filters, int concurrency,
+                               Scan::SortMode sort)
+                      : _filters(filters),
+                        _concurrency(concurrency),
+                        _sort(sort),
+                        _pending(0),
+                        _observer(0),
+                        _directory_count(0),
+                        _file_count(0),
+                        _reported(false)
+{
+    if (_concurrency < 1) _concurrency = 1;
+    for (int i = 0; i < _concurrency; i++)
+        _queues << new Queue;
+}
+
+ScanComponents::Walker::~Walker()
+{
+    qDeleteAll(_queues);
+    qDeleteAll(_visited_dirs);
+}
+
+/*!
+ * Sets the Scan object which is notified about the progress
+ * (and new files) and which can cancel the scan.
+ * The counters start at directories and files.
+ */
+void
+ScanComponents::Walker::setObserver(Scan *scan, int directories, int files)
+{
+    _observer = scan;
+    _directory_count.fetchAndStoreOrdered(directories);
+    _file_count.fetchAndStoreOrdered(files);
+}
+
+/*!
+ * Returns true if the observing Scan has been canceled.
+ */
+bool
+ScanComponents::Walker::isCanceled()
+const
+{
+    return _observer && _observer->isCanceled();
+}
+
+QStringList
+ScanComponents::Walker::walk(const QStringList &roots)
 {
     QStringList result_list;
-    if (path.isEmpty()) return result_list;
-    QDir::Filters flags;
-    flags = QDir::AllEntries; //Files + Directories
-    flags |= QDir::NoDotAndDotDot;
-    flags |= QDir::Hidden;
-    flags |= QDir::System;
-    QDir dir(path);
-    //"*.jpg" filter -> no directories (well, except "dir.jpg" maybe)
-    QFileInfoList filelist = dir.entryInfoList(filters, flags);
-    QFileInfoList dirlist = dir.entryInfoList(flags);
-    //Both entry lists contain both files and directories
-    //(as well as other file types, which are eventually ignored).
 
-    //Add files
-    foreach (QFileInfo info, filelist)
+    //Claim root directories, distribute them among the workers
+    QList<QPair<QString, DirectoryId> > root_dirs;
+    int root_count = 0;
+    foreach (QString path, roots)
+    {
+        if (path.isEmpty()) continue;
+        DirectoryId dir_id = Scan::directoryId(path);
+        root_dirs << qMakePair(path, dir_id);
+        Node *node = claim(path, dir_id);
+        if (!node) continue; //same directory added twice
+        _queues.at(root_count++ % _concurrency)->nodes << node;
+    }
+    if (!root_count) return result_list;
+    _pending.fetchAndStoreOrdered(root_count);
+    _report_timer.start();
+
+    //Start workers, this thread is worker 0
+    QList<Worker*> workers;
+    for (int i = 1; i < _concurrency; i++)
+    {
+        Worker *worker = new Worker(this, i);
+        workers << worker;
+        worker->start();
+    }
+    work(0);
+    foreach (Worker *worker, workers)
+    {
+        worker->wait();
+        delete worker;
+    }
+    if (isCanceled()) return result_list;
+
+    //Final numbers, remaining files
+    if (_observer)
+    {
+        QMutexLocker locker(&_report_mutex);
+        report(_directory_count.fetchAndAddOrdered(0),
+            _file_count.fetchAndAddOrdered(0));
+    }
+
+    //Collect files in order (files first, then subdirectories)
+    //Every directory is collected once, at the first path leading to it
+    //This is done without recursion, trees can be very deep
+    QSet<DirectoryId> collected_dirs;
+    QList<QPair<QString, DirectoryId> > stack;
+    for (int i = root_dirs.size() - 1; i >= 0; i--)
+        stack << root_dirs.at(i);
+    while (!stack.isEmpty())
     {
-        if (!info.isFile()) continue; //Because of QDir::AllEntries
-        QString item = info.filePath();
-        result_list << item;
+        QPair<QString, DirectoryId> dir = stack.takeLast();
+        if (collected_dirs.contains(dir.second)) continue;
+        collected_dirs.insert(dir.second);
+        Node *node = _visited_dirs.value(dir.second);
+        if (!node) continue;
+
+        QString prefix = dir.first;
+        if (!prefix.endsWith('/')) prefix += '/';
+        foreach (QString name, node->files)
+            result_list << prefix + name;
+        for (int i = node->dirs.size() - 1; i >= 0; i--)
+        {
+            QString path = prefix + node->dirs.at(i);
+            stack << qMakePair(path, node->dir_ids.at(i));
+        }
     }
 
-    //Add directories
-    foreach (QFileInfo info, dirlist)
+    return result_list;
+}
+
+void
+ScanComponents::Walker::work(int id)
+{
+    forever
     {
-        if (info.isFile()) continue;
-        if (!info.isDir()) continue; //Because of QDir::AllEntries
-        QString item = info.filePath();
-        if (recursive == RecursionMode::Recursive && info.isDir())
+        //Stop if canceled (queued directories are simply dropped)
+        if (isCanceled()) break;
+
+        //Take next directory (own queue first, then steal)
+        Node *node = take(id);
+        if (node)
         {
-            //Note: Scanning a directory which contains a symlink
-            //pointing to itself (or higher, within path) will lead
-            //to an INFINITE LOOP!
-            //We keep track of the scanned directories to prevent duplicates
-            if (!scanned_dirs.contains(item))
+            process(id, node);
+
+            //Last directory done, wake up idle workers so they can quit
+            if (!_pending.deref())
             {
-                //Add files in (sub)directory (not the directory itself)
-                result_list << scan(
-                    item, filters, RecursionMode::Recursive, scanned_dirs);
-                scanned_dirs << item;
+                QMutexLocker locker(&_idle_mutex);
+                _idle_condition.wakeAll();
             }
+            continue;
         }
+
+        //Nothing to do, done if no directory left anywhere
+        //Otherwise, wait for another worker to find more
+        QMutexLocker locker(&_idle_mutex);
+        if (!_pending.testAndSetOrdered(0, 0)) //pending != 0
+            _idle_condition.wait(&_idle_mutex, 10);
+        else
+            break;
     }
+}
+
+ScanComponents::Walker::Node*
+ScanComponents::Walker::claim(const QString &path, const DirectoryId &dir_id)
+{
+    //Claim directory, unless it has already been claimed
+    //This is a hash lookup, even if there are 100k directories
+    QMutexLocker locker(&_visited_mutex);
+    if (_visited_dirs.contains(dir_id)) return 0;
+    Node *node = new Node;
+    node->path = path;
+    _visited_dirs.insert(dir_id, node);
+    return node;
+}
 
-    //Files in subdirectories added by parent overload of scan()!
+ScanComponents::Walker::Node*
+ScanComponents::Walker::take(int id)
+{
+    Node *node = 0;
 
-    return result_list;
+    //Own queue, newest directory first
+    {
+        Queue *queue = _queues.at(id);
+        QMutexLocker locker(&queue->mutex);
+        if (!queue->nodes.isEmpty()) node = queue->nodes.takeLast();
+    }
+    if (node) return node;
+
+    //Steal oldest directory from another worker
+    for (int i = 1; i < _concurrency && !node; i++)
+    {
+        Queue *queue = _queues.at((id + i) % _concurrency);
+        QMutexLocker locker(&queue->mutex);
+        if (!queue->nodes.isEmpty()) node = queue->nodes.takeFirst();
+    }
+
+    return node;
 }
 
-QStringList
-Scan::paths()
+void
+ScanComponents::Walker::process(int id, Node *node)
 {
-    return _paths;
+    //List directory
+    Scan::read(node->path, _filters, node->files, node->dirs,
+        &node->dir_ids, _sort);
+
+    QString prefix = node->path;
+    if (!prefix.endsWith('/')) prefix += '/';
+
+    //Count, pass new files on to the observer
+    //The first files are passed on right away, then in batches
+    //to keep the number of signals (and receiver updates) low
+    int directories = _directory_count.fetchAndAddOrdered(1) + 1;
+    int files = _file_count.fetchAndAddOrdered(node->files.size()) +
+        node->files.size();
+    if (_observer)
+    {
+        QStringList found_files;
+        foreach (QString name, node->files)
+            found_files << prefix + name;
+        QMutexLocker locker(&_report_mutex);
+        _found_batch << found_files;
+        if ((!_reported && !_found_batch.isEmpty()) ||
+            _report_timer.elapsed() >= 100)
+            report(directories, files);
+    }
+
+    //Claim subdirectories (in order)
+    //Subdirectories that have been claimed already (symlink to a parent,
+    //bind mount, ...) are skipped, they're listed once
+    QList<Node*> children;
+    for (int i = 0, ii = node->dirs.size(); i < ii; i++)
+    {
+        Node *child = claim(prefix + node->dirs.at(i), node->dir_ids.at(i));
+        if (child) children << child;
+    }
+    if (children.isEmpty()) return;
+
+    //Queue subdirectories (before this one is marked as done)
+    //Reversed, so that the first one is taken first
+    _pending.fetchAndAddOrdered(children.size());
+    {
+        Queue *queue = _queues.at(id);
+        QMutexLocker locker(&queue->mutex);
+        for (int i = children.size() - 1; i >= 0; i--)
+            queue->nodes << children.at(i);
+    }
+
+    //Let idle workers steal some
+    QMutexLocker locker(&_idle_mutex);
+    _idle_condition.wakeAll();
 }
 
-QStringList
-Scan::filter()
+void
+ScanComponents::Walker::report(int directories, int files)
+{
+    //Called with _report_mutex locked
+    if (isCanceled()) return;
+    if (!_found_batch.isEmpty())
+    {
+        _observer->reportFound(_found_batch);
+        _found_batch.clear();
+        _reported = true;
+    }
+    _observer->reportProgress(directories, files);
+    _report_timer.restart();
+}
+
+ScanComponents::Worker::Worker(Walker *walker, int id)
+                      : _walker(walker),
+                        _id(id)
 {
-    return _typefilter;
 }
 
+void
+ScanComponents::Worker::run()
+{
+    _walker->work(_id);
+}
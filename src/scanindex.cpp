@@ -0,0 +1,340 @@
+#include "scanindex.hpp"
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+/*! \class ScanIndex
+ *
+ * \brief The ScanIndex class remembers directory listings,
+ * so that unchanged directories don't have to be read again.
+ *
+ * Every entry contains the filtered listing of a directory
+ * and the modification time of that directory at the time it was read.
+ * Creating, deleting or renaming an entry changes the modification time
+ * of the directory, so an entry is valid as long as the modification time
+ * is the same. Checking it takes one stat() call per directory,
+ * which is a lot cheaper than reading the directory
+ * (and checking all of its subdirectories).
+ *
+ * The index is used by Scan, see Scan::setIndex().
+ * It's thread-safe, the scanner threads use it at the same time.
+ *
+ * The index can be saved to a file, so that it survives a restart.
+ * Only directories that have been used since it has been loaded are saved,
+ * entries of directories that are no longer scanned are dropped.
+ *
+ * Entries are only valid for one set of filters.
+ * If the filters change, all entries are dropped.
+ *
+ * Identifiers of subdirectories (device and inode numbers) are not
+ * kept, device numbers may change when filesystems are mounted again.
+ * Scan identifies the subdirectories of a listing taken from the index
+ * again (one stat() call each).
+ *
+ * Every file in an entry may have a color (average color of the picture,
+ * see setColor()), which is shown while its thumbnail is being loaded.
+ * It's kept as long as the file is listed in the entry.
+ *
+ */
+
+/*!
+ * Returns the modification time of the file (or directory) at path,
+ * in nanoseconds, or -1 if it's not found.
+ */
+qint64
+ScanIndex::modificationTime(const QString &path)
+{
+    #if !defined(_WIN32)
+    struct stat st;
+    if (stat(QFile::encodeName(path).constData(), &st)) return -1;
+    #if defined(__linux__)
+    return (qint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    #else
+    return (qint64)st.st_mtime * 1000000000;
+    #endif
+    #else
+    QFileInfo fi(path);
+    if (!fi.exists()) return -1;
+    return fi.lastModified().toMSecsSinceEpoch() * 1000000;
+    #endif
+}
+
+/*!
+ * Constructs an empty ScanIndex.
+ */
+ScanIndex::ScanIndex()
+{
+}
+
+/*!
+ * Returns the file this index has been loaded from.
+ */
+QString
+ScanIndex::fileName()
+const
+{
+    QMutexLocker locker(&_mutex);
+    return _file;
+}
+
+/*!
+ * Returns the number of directories in this index.
+ */
+int
+ScanIndex::count()
+const
+{
+    QMutexLocker locker(&_mutex);
+    return _entries.size();
+}
+
+/*!
+ * Loads the index from file. It will be saved to the same file.
+ * Returns false if the file could not be read, in which case
+ * the index is empty.
+ */
+bool
+ScanIndex::load(const QString &file)
+{
+    QMutexLocker locker(&_mutex);
+    _file = file;
+    _filters.clear();
+    _entries.clear();
+    _used_paths.clear();
+
+    QFile index_file(file);
+    if (!index_file.open(QIODevice::ReadOnly)) return false;
+    QDataStream stream(&index_file);
+    //QDataStream version not defined
+
+    //Header
+    quint32 magic = 0, version = 0;
+    stream >> magic >> version;
+    if (magic != 0x57505349 || version != 1) return false; //"WPSI"
+
+    //Filters
+    stream >> _filters;
+
+    //Entries
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++)
+    {
+        QString path;
+        Entry entry;
+        stream >> path >> entry.mtime >> entry.files >> entry.dirs;
+        stream >> entry.colors;
+        _entries.insert(path, entry);
+    }
+
+    //Broken file, don't trust any of it
+    if (stream.status() != QDataStream::Ok)
+    {
+        _filters.clear();
+        _entries.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * Saves the index to the file it has been loaded from.
+ * Returns false on error.
+ */
+bool
+ScanIndex::save()
+const
+{
+    QMutexLocker locker(&_mutex);
+    if (_file.isEmpty()) return false;
+
+    //Write to temporary file first, then replace the old one
+    //An interrupted write must not leave a truncated index behind
+    QString tmp_file = _file + ".tmp";
+    QDir().mkpath(QFileInfo(_file).absolutePath());
+    QFile index_file(tmp_file);
+    if (!index_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QDataStream stream(&index_file);
+    //QDataStream version not defined
+
+    //Header
+    stream << (quint32)0x57505349 << (quint32)1;
+
+    //Filters
+    stream << _filters;
+
+    //Entries (only those in use)
+    quint32 count = 0;
+    foreach (QString path, _used_paths)
+        if (_entries.contains(path)) count++;
+    stream << count;
+    foreach (QString path, _used_paths)
+    {
+        if (!_entries.contains(path)) continue;
+        const Entry &entry = _entries[path];
+        stream << path << entry.mtime << entry.files << entry.dirs;
+        stream << entry.colors;
+    }
+
+    index_file.close();
+    if (index_file.error() != QFile::NoError ||
+        stream.status() != QDataStream::Ok)
+    {
+        QFile::remove(tmp_file);
+        return false;
+    }
+    QFile::remove(_file);
+    return QFile::rename(tmp_file, _file);
+}
+
+/*!
+ * Looks up the directory at path, which has been modified at mtime
+ * (see modificationTime()).
+ * Returns true and appends the listing to file_names and dir_names
+ * if there's a valid entry.
+ * Returns false if the directory has to be read.
+ */
+bool
+ScanIndex::lookup(const QString &path,
+                  const QStringList &filters,
+                  qint64 mtime,
+                  QStringList &file_names,
+                  QStringList &dir_names)
+{
+    QMutexLocker locker(&_mutex);
+    if (mtime < 0 || filters != _filters) return false;
+
+    //Find entry, check if it's still valid
+    QHash<QString, Entry>::const_iterator it = _entries.constFind(path);
+    if (it == _entries.constEnd()) return false;
+    const Entry &entry = it.value();
+    if (entry.mtime != mtime) return false; //modified
+    _used_paths.insert(path);
+
+    file_names << entry.files;
+    dir_names << entry.dirs;
+    return true;
+}
+
+/*!
+ * Adds or replaces the entry for the directory at path,
+ * which has been read at modification time mtime.
+ */
+void
+ScanIndex::insert(const QString &path,
+                  const QStringList &filters,
+                  qint64 mtime,
+                  const QStringList &file_names,
+                  const QStringList &dir_names)
+{
+    QMutexLocker locker(&_mutex);
+
+    //Another set of filters, old entries are useless
+    if (filters != _filters)
+    {
+        _filters = filters;
+        _entries.clear();
+        _used_paths.clear();
+    }
+
+    //Don't remember directories that have been modified a moment ago
+    //Another change within the resolution of the timestamp
+    //would go unnoticed (the modification time would be the same)
+    qint64 now = QDateTime::currentMSecsSinceEpoch() * 1000000;
+    if (mtime < 0 || mtime > now - (qint64)2000000000)
+    {
+        _entries.remove(path);
+        return;
+    }
+
+    Entry entry;
+    entry.mtime = mtime;
+    entry.files = file_names;
+    entry.dirs = dir_names;
+
+    //Keep colors of files that are still there
+    QHash<QString, Entry>::const_iterator it = _entries.constFind(path);
+    if (it != _entries.constEnd() && !it.value().colors.isEmpty())
+    {
+        const QHash<QString, quint32> &colors = it.value().colors;
+        foreach (QString name, file_names)
+            if (colors.contains(name)) entry.colors[name] = colors[name];
+    }
+
+    _entries.insert(path, entry);
+    _used_paths.insert(path);
+}
+
+/*!
+ * Sets the color (ARGB) of the picture file (full path),
+ * usually its average color.
+ * Nothing happens if its directory is not in the index.
+ */
+void
+ScanIndex::setColor(const QString &file, quint32 color)
+{
+    QMutexLocker locker(&_mutex);
+    QString name;
+    QString path = entryPath(file, &name);
+    if (path.isEmpty()) return;
+    _entries[path].colors[name] = color;
+}
+
+/*!
+ * Returns the colors of the given files (full paths), see setColor().
+ * Files without color are not included.
+ */
+QHash<QString, quint32>
+ScanIndex::colors(const QStringList &files)
+const
+{
+    QMutexLocker locker(&_mutex);
+    QHash<QString, quint32> colors;
+    foreach (QString file, files)
+    {
+        QString name;
+        QString path = entryPath(file, &name);
+        if (path.isEmpty()) continue;
+        const QHash<QString, quint32> &entry_colors =
+            _entries.constFind(path).value().colors;
+        QHash<QString, quint32>::const_iterator it =
+            entry_colors.constFind(name);
+        if (it != entry_colors.constEnd()) colors.insert(file, it.value());
+    }
+    return colors;
+}
+
+/*!
+ * Returns the path of the entry of the directory containing file
+ * (or an empty string) and sets name to the file name.
+ * The mutex must be locked.
+ */
+QString
+ScanIndex::entryPath(const QString &file, QString *name)
+const
+{
+    int pos = file.lastIndexOf('/');
+    if (pos < 0) return QString();
+    *name = file.mid(pos + 1);
+
+    //Directory with or without trailing slash
+    QString path = file.left(pos);
+    if (_entries.contains(path)) return path;
+    path = file.left(pos + 1);
+    if (_entries.contains(path)) return path;
+    return QString();
+}
+
+/*!
+ * Removes all entries.
+ */
+void
+ScanIndex::clear()
+{
+    QMutexLocker locker(&_mutex);
+    _entries.clear();
+    _used_paths.clear();
+}
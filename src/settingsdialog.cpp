@@ -153,6 +153,17 @@ SettingsDialog::SettingsDialog(QWidget *parent)
             SIGNAL(valueChanged(int)),
             SLOT(checkCacheLimit(int)));
 
+    //Thumbnail cache warmer
+    chk_warm_cache = new QCheckBox(tr("Create thumbnails in the background"));
+    chk_warm_cache->setChecked(wallphiller->isThumbnailWarmingEnabled());
+    chk_warm_cache->setToolTip(tr(
+        "Create missing thumbnails of all pictures in the playlist "
+        "while the computer is idle, so they can be shown right away. "
+        "They're stored in the shared thumbnail directory."));
+    cache_layout->addRow(chk_warm_cache);
+    if (ThumbnailCache::directory().isEmpty())
+        chk_warm_cache->setEnabled(false);
+
     //Horizontal line
     QFrame *hline = new QFrame;
     hline->setFrameShape(QFrame::HLine);
@@ -268,6 +279,8 @@ SettingsDialog::saveAndClose()
     wallphiller->applyChangeRoutine(new_routine, new_command);
     wallphiller->applyInterval(new_interval_value, new_interval_unit);
     wallphiller->applyCacheLimit(new_cache_limit);
+    if (chk_warm_cache->isChecked() != wallphiller->isThumbnailWarmingEnabled())
+        wallphiller->applyThumbnailWarming(chk_warm_cache->isChecked());
     close();
 }
 
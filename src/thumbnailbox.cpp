@@ -1,4 +1,5 @@
 #include "thumbnailbox.hpp"
+#include "picture.hpp"
 
 /*! \class ThumbnailBox
  *
@@ -22,14 +23,33 @@
  * If External is used as source type, the parent module (or something else)
  * is responsible for loading the images.
  * This ThumbnailBox object will merely emit a signal (carrying the address)
- * whenever an image is needed (imageRequested()).
+ * whenever an image is needed (thumbnailRequested()).
  * The parent module is expected to catch this signal, load the image
  * and send it to the cacheImage() slot.
  * It can be loaded in the background to prevent the gui from freezing.
+ * The signal carries the preview size limit, so that the image
+ * can be decoded in that size rather than in full size
+ * (much faster for big pictures).
+ * The request carries a priority and the generation of the viewport.
+ * Whenever other items are shown (scrolling), the generation
+ * is incremented (viewportChanged()). Requests of older generations
+ * that have not been processed yet are obsolete, their items
+ * are not visible anymore. The loader should drop them, so that the visible
+ * thumbnails don't have to wait for them.
+ * While the scrollbar is dragged fast, nothing is requested at all,
+ * only cached thumbnails are shown (see isFlinging()).
+ * Thumbnails that are not cached are filled with a placeholder color
+ * (usually the average color of the picture), if it's known
+ * (see setPlaceholderColors()).
  *
  * As long as any type other than Local is used,
  * image addresses could be remote urls.
  *
+ * Items can be appended to the list while it's being shown, see append(),
+ * or removed from it, see remove().
+ * This is meant for long lists that are generated in the background
+ * or that change while they're shown.
+ *
  * Loaded previews are cached.
  *
  * Loaded previews may be shrunk to save memory.
@@ -38,9 +58,19 @@
  * all images in the list in memory at the same time, except for small lists.
  * Even if hundreds of images are in the list, the number of thumbnail
  * widgets will be just enough to fill the viewport properly.
+ * These widgets are reused when scrolling, they're bound to other items
+ * (no widgets are created unless the viewport is resized).
  * The cache is limited too, so that Jon Doe can scroll through his
  * collection of 20k high-def pictures without the program
  * using a Firefox-typical amount of memory.
+ * It holds a few screens of thumbnails (whatever fits at the current
+ * thumbnail size), but never more than the limit (setCacheLimit()).
+ * Thumbnails are drawn from a second, smaller cache of pixmaps,
+ * which are already scaled to the preview size (see cachedPixmap()).
+ * Thumbnails that are evicted from the cache are compressed in another
+ * thread and kept for a while. They're decompressed in that thread
+ * when they're requested again, so they're not painted right away,
+ * just like thumbnails that aren't cached at all.
  *
  */
 
@@ -48,13 +78,27 @@ ThumbnailBox::ThumbnailBox(QWidget *parent)
             : QFrame(parent),
               updating_thumbnails(false),
               _index(-1),
+              _generation(0),
               _size(.3),
               _showdirs(false),
               _isclickable(true),
               _max_cache_pix_dimensions(200, 200),
-              _pixcache(500 * 1024), //500 KB
+              _pixcache(0), //sized automatically
+              _cache_limit(0),
+              _display_cache(0), //sized automatically, visible ones
               _source_type(SourceType::Local),
-              _image_loader_function(0)
+              _image_loader_function(0),
+              _thumb_pool_columns(0),
+              _thumb_pool_width(0),
+              _view(0),
+              _last_scroll_time(0),
+              _last_top_row(0),
+              _scroll_direction(0),
+              _scroll_velocity(0),
+              _decode_latency(100),
+              _deferred(false),
+              _codec_thread(0),
+              _codec(0)
 {
     //Copy original palette (may be changed, see setDarkBackground())
     _original_palette = palette();
@@ -81,6 +125,7 @@ ThumbnailBox::ThumbnailBox(QWidget *parent)
     connect(scrollbar,
             SIGNAL(valueChanged(int)),
             SLOT(updateThumbnails(int)));
+    connect(scrollbar, SIGNAL(sliderReleased()), SLOT(settleScrolling()));
     hbox->addWidget(scrollbar);
 
     //Update view on resize
@@ -94,12 +139,54 @@ ThumbnailBox::ThumbnailBox(QWidget *parent)
             SIGNAL(rightClicked(int, const QPoint&)),
             SLOT(showMenu(int, const QPoint&)));
 
+    //Initial cache size (adjusted to the grid later)
+    updateCacheSize();
+
+    //Scroll speed and decode latency (prefetch)
+    _clock.start();
+
+    //Load deferred images once scrolling settles (fling)
+    _settle_timer.setSingleShot(true);
+    _settle_timer.setInterval(200);
+    connect(&_settle_timer, SIGNAL(timeout()), SLOT(settleScrolling()));
+
+    //Codec thread, compresses evicted thumbnails and decompresses them
+    //(not in the gui thread, that would stall painting and scrolling)
+    _codec = new ImageCodec;
+    _codec_thread = new QThread;
+    _codec->moveToThread(_codec_thread);
+    connect(this,
+            SIGNAL(compressionRequested(const QString&, const QImage&)),
+            _codec,
+            SLOT(compress(const QString&, const QImage&)));
+    connect(this,
+            SIGNAL(decompressionRequested(const QString&, const QByteArray&)),
+            _codec,
+            SLOT(decompress(const QString&, const QByteArray&)));
+    connect(_codec,
+            SIGNAL(compressed(const QString&, const QByteArray&)),
+            SLOT(receiveCompressed(const QString&, const QByteArray&)));
+    connect(_codec,
+            SIGNAL(decompressed(const QString&, const QImage&)),
+            SLOT(receiveDecompressed(const QString&, const QImage&)));
+    _codec_thread->start();
+
+}
+
+ThumbnailBox::~ThumbnailBox()
+{
+    //Stop codec thread (pending requests are dropped)
+    _codec_thread->quit();
+    _codec_thread->wait();
+    delete _codec;
+    delete _codec_thread;
 }
 
 int
 ThumbnailBox::availableWidth()
 const
 {
+    if (_view) return _view->viewport()->width();
     return thumbcontainer->width();
 }
 
@@ -107,6 +194,7 @@ int
 ThumbnailBox::availableHeight()
 const
 {
+    if (_view) return _view->viewport()->height();
     return thumbcontainer->height();
 }
 
@@ -140,6 +228,7 @@ int
 ThumbnailBox::topRow()
 const
 {
+    if (_view) return _view->topRow();
     int scrollpos = scrollbar->value();
     return scrollpos;
 }
@@ -174,9 +263,31 @@ QList<int>
 ThumbnailBox::visibleIndexes()
 const
 {
+    if (_view) return _view->visibleIndexes();
     return _visible_thumbnails_in_viewport.keys();
 }
 
+QStringList
+ThumbnailBox::checkedPaths(const QStringList &paths)
+const
+{
+    //Check provided paths (only if they're local files)
+    if (sourceType() != SourceType::Local) return paths;
+    QStringList list;
+    foreach (QString path, paths)
+    {
+        QFileInfo inf(path);
+        if ((!inf.isFile()) &&
+            (!inf.isDir() || !directoriesVisible()))
+        {
+            continue; //not found, ignore invalid entry
+        }
+        path = inf.absoluteFilePath(); //full local path
+        list << path;
+    }
+    return list;
+}
+
 QPointer<ThumbnailBox::Thumb>
 ThumbnailBox::thumbAtIndex(int index)
 const
@@ -191,13 +302,24 @@ QColor
 ThumbnailBox::fileColor(const QString &file)
 const
 {
-    QColor color;
-    if (_file_colors.contains(file))
-    {
-        int number = _file_colors[file];
-        if (_colors.contains(number)) color = _colors[number];
-    }
-    return color;
+    //Called for every painted thumbnail, single lookup each
+    int number = _file_colors.value(file);
+    if (!number) return QColor();
+    return _colors.value(number);
+}
+
+/*!
+ * Returns the color shown in place of the thumbnail of file
+ * while it's not cached (invalid color if there's none).
+ */
+QColor
+ThumbnailBox::placeholderColor(const QString &file)
+const
+{
+    QHash<QString, QRgb>::const_iterator it =
+        _placeholder_colors.constFind(file);
+    if (it == _placeholder_colors.constEnd()) return QColor();
+    return QColor(it.value());
 }
 
 QImage
@@ -205,41 +327,94 @@ ThumbnailBox::cachedImage(const QString &file)
 const
 {
     //Get cached image or create empty image if not cached
-    //Cached image (heap) is (shallow) copied locally first (stack)
-    //Cached image could be deleted at any point (managed by cache)
-    QImage image;
-    if (_pixcache.contains(file))
-        image = QImage(*_pixcache.object(file)); //local shallow copy
-
-    return image;
+    //The cache returns a (shallow) copy, it could be evicted at any point
+    //A lookup counts as a hit (cache order)
+    //Compressed images are not returned, see requestImage()
+    return _pixcache.object(file);
 }
 
+/*!
+ * Returns the cached preview of file as a pixmap, scaled to fit into
+ * previewSize(), or an empty pixmap if it's not cached.
+ *
+ * The pixmaps are kept in a separate cache, so repainting a thumbnail
+ * neither converts nor scales anything. That cache is cleared
+ * when the thumbnail size changes.
+ */
 QPixmap
 ThumbnailBox::cachedPixmap(const QString &file)
 const
 {
+    //Display cache is only valid for one thumbnail size
+    QSize size = previewSize();
+    if (size != _display_size)
+    {
+        _display_cache.clear();
+        _display_size = size;
+    }
+
+    //Display-ready pixmap, drawn as it is
+    if (_display_cache.contains(file))
+        return *_display_cache.object(file);
+
     //Get cached image
     QImage image = cachedImage(file);
-
-    //Convert to QPixmap (if found, empty otherwise)
-    QPixmap pixmap;
-    if (!image.isNull())
-        pixmap.convertFromImage(image);
+    if (image.isNull()) return QPixmap();
+
+    //Scale to preview size, convert to premultiplied format once
+    //(painting any other format converts it every time)
+    QImage::Format format = image.hasAlphaChannel() ?
+        QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    if (image.width() > size.width() || image.height() > size.height())
+        image = image.scaled(size, Qt::KeepAspectRatio,
+            Qt::SmoothTransformation);
+    if (image.format() != format) image = image.convertToFormat(format);
+    QPixmap pixmap = QPixmap::fromImage(image);
+    int cost = image.byteCount();
+    _display_cache.insert(file, new QPixmap(pixmap), cost); //owned by cache
 
     return pixmap;
 }
 
+/*!
+ * Returns the size of the preview area of a thumbnail,
+ * which is the thumbnail without its margins and title.
+ * Cached pixmaps are scaled to fit into this size.
+ */
+QSize
+ThumbnailBox::previewSize()
+const
+{
+    //Thumbnail layout margins and spacing (see Thumb)
+    int margin = 9;
+    int spacing = 6;
+    int width = thumbWidth() - 2 * margin;
+    int height = width - fontMetrics().height() - spacing;
+    return QSize(width, height).expandedTo(QSize(1, 1));
+}
+
 void
-ThumbnailBox::requestImage(const QString &path)
+ThumbnailBox::requestImage(const QString &path, Priority priority)
 {
     //Request image (identified by path)
-    //Response -> compress -> cacheImage() -> thumbnail drawn
-    //If the compressed image doesn't fit in the cache,
+    //Response -> cacheImage() (shrinks it) -> thumbnail drawn
+    //Images are compressed later, when they're evicted (codec thread)
+    //If the shrunk image doesn't fit in the cache,
     //it will not be displayed. Again, it will not be displayed.
     //This might be due to an undersized cache or oversized preview limit.
     //At the time of writing, the default preview limit is 200x200 px
     //and the cache limit is 500 KB, tested images are 150-200 KB in size.
 
+    //Compressed copy cached, decompress it in the background
+    //(cheaper than loading it again, response -> receiveDecompressed())
+    if (_pixcache.containsCompressed(path))
+    {
+        if (_decompressing.contains(path)) return; //already requested
+        _decompressing.insert(path);
+        emit decompressionRequested(path, _pixcache.compressedObject(path));
+        return;
+    }
+
     QImage image;
     switch (sourceType())
     {
@@ -262,7 +437,12 @@ ThumbnailBox::requestImage(const QString &path)
         //Request image from external loader (path is uri)
         //Response will be sent to cacheImage() by parent module
         //This is async by design
-        emit imageRequested(path);
+        //Request time is kept to measure the latency (prefetch)
+        if (_request_times.size() > 1000) _request_times.clear();
+        if (!_request_times.contains(path))
+            _request_times.insert(path, _clock.elapsed());
+        emit thumbnailRequested(path, _max_cache_pix_dimensions,
+            (int)priority, _generation);
         break;
 
     }
@@ -287,6 +467,9 @@ ThumbnailBox::wheelEvent(QWheelEvent *event)
     if (event->orientation() != Qt::Vertical) return;
     if (!scrollbar->isEnabled()) return;
 
+    //Scroll direction, before the thumbnails are updated (prefetch)
+    if (steps) _scroll_direction = steps > 0 ? -1 : 1;
+
     scrollbar->setValue(scrollbar->value() - steps);
 
     event->accept();
@@ -320,6 +503,13 @@ ThumbnailBox::showMenu(int index, const QPoint &pos)
 void
 ThumbnailBox::updateThumbnail(int index)
 {
+    //Painted view, repaint that item only
+    if (_view)
+    {
+        _view->updateItem(index);
+        return;
+    }
+
     //Check if thumbnail visible
     if (!visibleIndexes().contains(index))
         return; //it's not
@@ -369,6 +559,7 @@ const
     QSize original_size = original_image.size();
 
     //Resize image (if necessary)
+    //Pixels are averaged (no aliasing), see Picture::downscale()
     QImage image(original_image); //shallow copy
     if (max_size.isValid())
     {
@@ -376,7 +567,7 @@ const
             original_size.height() > max_size.height())
         {
             //Image is bigger, shrink it
-            image = image.scaled(max_size, Qt::KeepAspectRatio);
+            image = Picture::downscale(image, max_size);
         }
     }
 
@@ -416,12 +607,41 @@ const
 /*!
  * Returns the index of this file.
  * Returns -1 if not found.
+ *
+ * This is a hash lookup, it's called for every loaded image.
  */
 int
 ThumbnailBox::indexOf(const QString &file)
 const
 {
-    return list().indexOf(file);
+    return _item_indexes.value(file, -1);
+}
+
+/*!
+ * Updates the address index for the items starting at first,
+ * the items before are expected to be indexed (removed items
+ * must have been dropped from the index already).
+ * If an address appears more than once, its first index is used,
+ * like QStringList::indexOf() would.
+ */
+void
+ThumbnailBox::indexItems(int first)
+{
+    //Forget positions from first on, they might have moved
+    //(earlier positions of duplicates are kept)
+    if (!first) _item_indexes.clear();
+    for (int i = first, ii = _list.size(); i < ii && first; i++)
+    {
+        QHash<QString, int>::iterator it = _item_indexes.find(_list.at(i));
+        if (it != _item_indexes.end() && it.value() >= first)
+            _item_indexes.erase(it);
+    }
+
+    for (int i = first, ii = _list.size(); i < ii; i++)
+    {
+        const QString &path = _list.at(i);
+        if (!_item_indexes.contains(path)) _item_indexes.insert(path, i);
+    }
 }
 
 /*!
@@ -438,6 +658,17 @@ const
     return index;
 }
 
+/*!
+ * Returns the generation of the viewport.
+ * It is incremented whenever the thumbnails are recreated.
+ */
+int
+ThumbnailBox::generation()
+const
+{
+    return _generation;
+}
+
 /*!
  * Returns true if a thumbnail is selected or false otherwise.
  */
@@ -530,6 +761,26 @@ const
     return _actions.size();
 }
 
+/*!
+ * Returns the view mode, see setViewMode().
+ */
+ThumbnailBox::ViewMode
+ThumbnailBox::viewMode()
+const
+{
+    return _view ? ViewMode::Painted : ViewMode::Widgets;
+}
+
+/*!
+ * Returns the maximum dimensions of the cached image previews.
+ */
+QSize
+ThumbnailBox::previewSizeLimit()
+const
+{
+    return _max_cache_pix_dimensions;
+}
+
 /*!
  * Sets the frame style.
  */
@@ -579,6 +830,54 @@ ThumbnailBox::setPreviewSizeLimit(int wh)
     if (wh < 0) wh = 0;
     _max_cache_pix_dimensions.setWidth(wh);
     _max_cache_pix_dimensions.setHeight(wh);
+    updateCacheSize();
+}
+
+/*!
+ * Sets the view mode.
+ *
+ * ViewMode::Widgets shows each thumbnail in its own widget (default).
+ * ViewMode::Painted paints all thumbnails in a single widget,
+ * which is faster, scrolls smoothly (pixel by pixel)
+ * and only repaints the thumbnails that have changed.
+ * Both modes have the same interface (signals, selection...).
+ */
+void
+ThumbnailBox::setViewMode(ViewMode mode)
+{
+    if (mode == viewMode()) return;
+
+    //Drop thumbnails of the old mode
+    //Neither of them is deleted right away (see select())
+    _visible_thumbnails_in_viewport.clear();
+    _visible_paths.clear();
+    if (thumbarea)
+    {
+        thumbarea->hide();
+        thumbarea->deleteLater();
+    }
+    _thumb_pool.clear();
+    if (_view)
+    {
+        _view->hide();
+        _view->deleteLater();
+        _view = 0;
+    }
+
+    //Create painted view, replacing the thumbnail area and its scrollbar
+    if (mode == ViewMode::Painted)
+    {
+        _view = new ThumbView(this);
+        layout()->addWidget(_view);
+        connectThumbSignals(_view);
+        connect(_view->verticalScrollBar(),
+                SIGNAL(sliderReleased()),
+                SLOT(settleScrolling()));
+    }
+    thumbcontainer->setVisible(!_view);
+    scrollbar->setVisible(!_view);
+
+    scheduleUpdateThumbnails(0);
 }
 
 /*!
@@ -599,6 +898,11 @@ ThumbnailBox::setItemsClickable(bool enable)
  * Unless another cache is used, this limit should be increased
  * to reduce the number of image requests and improve performance.
  *
+ * The cache is sized to hold a few screens of thumbnails,
+ * this limit caps that size (including the pixmaps of the visible
+ * thumbnails). The remaining space holds compressed thumbnails.
+ * 0 means no limit.
+ *
  * Images that don't fit in the cache will be dropped and not be displayed.
  */
 void
@@ -606,7 +910,103 @@ ThumbnailBox::setCacheLimit(int max_mb)
 {
     if (max_mb < 0) max_mb = 1; //need cache, enforce minimum size of 1 MB
     int max_bytes = max_mb * 1024 * 1024;
-    _pixcache.setMaxCost(max_bytes);
+    _cache_limit = max_bytes;
+    updateCacheSize();
+}
+
+/*!
+ * Sizes the cache to hold a few screens of thumbnails
+ * at the current grid dimensions, capped by the cache limit.
+ * A thumbnail costs up to the preview size limit (32 bit).
+ *
+ * The display cache (pixmaps, see cachedPixmap()) holds one screen
+ * at the preview size, it's taken from the limit first
+ * (a quarter of it at most).
+ *
+ * The rest of the limit (at least half of it, unless that's less
+ * than two screens) is used for compressed thumbnails.
+ */
+void
+ThumbnailBox::updateCacheSize()
+{
+    //Screens: viewport, prefetched rows and recently visited ones
+    int screens = 5;
+    int cols = qMax(columnCount(), 1);
+    int rows = qMax(rowCount(), 1) + 1; //partially visible
+    qint64 screen_cost = cols * rows * thumbnailCost();
+    qint64 max_cost = screens * screen_cost;
+
+    //Display-ready pixmaps of the visible thumbnails (32 bit)
+    QSize preview_size = previewSize();
+    qint64 display_cost =
+        cols * rows * (qint64)preview_size.width() * preview_size.height() * 4;
+
+    //User limit, shared with pixmaps and compressed thumbnails (warm tier)
+    //Without a limit, the warm tier gets 32 MB
+    qint64 warm_cost = 32 * 1024 * 1024;
+    if (_cache_limit)
+    {
+        qint64 limit = _cache_limit;
+        display_cost = qMin(display_cost, limit / 4);
+        limit -= display_cost;
+        max_cost = qMin(max_cost, qMax(limit / 2, 2 * screen_cost));
+        max_cost = qMin(max_cost, limit);
+        warm_cost = limit - max_cost;
+    }
+    max_cost = qMin(max_cost, (qint64)INT_MAX);
+    display_cost = qMin(display_cost, (qint64)INT_MAX);
+    if (display_cost != _display_cache.maxCost())
+        _display_cache.setMaxCost((int)display_cost);
+    if (max_cost != _pixcache.maxCost()) _pixcache.setMaxCost((int)max_cost);
+    if (warm_cost != _pixcache.warmMaxCost())
+        _pixcache.setWarmMaxCost((int)warm_cost);
+    compressEvicted();
+}
+
+/*!
+ * Sends the images that have been evicted from the cache
+ * to the codec thread, they're cached compressed when they're back
+ * (receiveCompressed()).
+ */
+void
+ThumbnailBox::compressEvicted()
+{
+    QHash<QString, QImage> images = _pixcache.takeEvicted();
+    QHash<QString, QImage>::const_iterator it;
+    for (it = images.constBegin(); it != images.constEnd(); ++it)
+        emit compressionRequested(it.key(), it.value());
+}
+
+void
+ThumbnailBox::receiveCompressed(const QString &file, const QByteArray &data)
+{
+    //Dropped if the image has been cached again (or removed) meanwhile
+    _pixcache.insertCompressed(file, data);
+}
+
+void
+ThumbnailBox::receiveDecompressed(const QString &file, const QImage &image)
+{
+    //Cache it (unless it's been loaded or removed meanwhile)
+    _decompressing.remove(file);
+    if (!_pixcache.restore(file, image)) return;
+    compressEvicted();
+    emit imageCached(file);
+
+    //Draw image on thumbnail widget (if thumbnail visible)
+    updateThumbnail(file);
+}
+
+/*!
+ * Returns the maximum size of a cached thumbnail in bytes.
+ */
+qint64
+ThumbnailBox::thumbnailCost()
+const
+{
+    QSize max_size = _max_cache_pix_dimensions;
+    if (!max_size.isValid() || max_size.isEmpty()) max_size = QSize(200, 200);
+    return (qint64)max_size.width() * max_size.height() * 4; //32 bit
 }
 
 /*!
@@ -709,6 +1109,23 @@ void
 ThumbnailBox::clearCache()
 {
     _pixcache.clear();
+    _display_cache.clear();
+}
+
+/*!
+ * Sets the placeholder colors of the given files,
+ * the colors of other files are kept.
+ * They're shown until the thumbnails are loaded.
+ * All colors are forgotten by clear() and setList().
+ */
+void
+ThumbnailBox::setPlaceholderColors(const QHash<QString, QRgb> &colors)
+{
+    //Not unite(), that would add a second entry for known files
+    QHash<QString, QRgb>::const_iterator it;
+    for (it = colors.constBegin(); it != colors.constEnd(); ++it)
+        _placeholder_colors.insert(it.key(), it.value());
+    if (_view) _view->viewport()->update();
 }
 
 /*!
@@ -721,14 +1138,21 @@ ThumbnailBox::clearCache()
 void
 ThumbnailBox::cacheImage(const QString &file, const QImage &image)
 {
-    //Put copy of QImage object (on heap) in cache (then managed by cache)
+    //Put (shallow) copy of image in cache
     //Image is shrunk before its cached (original one likely exceeds limit)
     QImage compressed_image = shrinkImage(image);
-    QImage *cached_image = new QImage(compressed_image); //on heap!
-    int size = cached_image->byteCount(); //size in bytes of compressed image
-    _pixcache.insert(file, cached_image, size); //ownership goes to cache
-    if (!_pixcache.contains(file))
+    _display_cache.remove(file); //outdated
+    int size = compressed_image.byteCount(); //size in bytes
+
+    //Decode latency (moving average)
+    if (_request_times.contains(file))
+    {
+        qint64 latency = _clock.elapsed() - _request_times.take(file);
+        _decode_latency = .8 * _decode_latency + .2 * latency;
+    }
+    if (!_pixcache.insert(file, compressed_image, size))
         return; //not cached (too big?), stop
+    compressEvicted();
     emit imageCached(file);
 
     //Draw image on thumbnail widget (if thumbnail visible)
@@ -743,7 +1167,8 @@ ThumbnailBox::cacheImage(const QString &file, const QImage &image)
 void
 ThumbnailBox::scrollToRow(int row)
 {
-    scrollbar->setValue(row);
+    if (_view) _view->scrollToRow(row);
+    else scrollbar->setValue(row);
 }
 
 /*!
@@ -752,7 +1177,8 @@ ThumbnailBox::scrollToRow(int row)
 void
 ThumbnailBox::scrollToTop()
 {
-    scrollbar->setValue(0);
+    if (_view) _view->verticalScrollBar()->setValue(0);
+    else scrollbar->setValue(0);
 }
 
 /*!
@@ -761,7 +1187,8 @@ ThumbnailBox::scrollToTop()
 void
 ThumbnailBox::scrollToBottom()
 {
-    scrollbar->setValue(scrollbar->maximum());
+    QScrollBar *bar = _view ? _view->verticalScrollBar() : scrollbar;
+    bar->setValue(bar->maximum());
 }
 
 /*!
@@ -774,13 +1201,10 @@ ThumbnailBox::updateThumbnails()
     int count = this->count(); //total number of files
     int thumbwidth;
     int thumbheight;
-    int padding = 5;
     int cols;
     int rows;
     int totalrows; //row count (incl. hidden)
     int totalhiddenrows;
-    int maxthumbs; //maximum visible thumbs
-    int visiblethumbs; //visible thumbs needed
     int scrollpos;
     int hiddenrows; //rows hidden ABOVE viewport
     int hiddenthumbs; //thumbs hidden ABOVE viewport
@@ -792,6 +1216,21 @@ ThumbnailBox::updateThumbnails()
     if (updating_thumbnails) return;
     updating_thumbnails = true;
 
+    //Grid dimensions might have changed
+    updateCacheSize();
+
+    //Painted view (single widget, no thumbnail widgets)
+    //Repainted if the grid or the visible items have changed
+    if (_view)
+    {
+        bool changed = _view->layoutItems();
+        if (updateVisibleItems()) changed = true;
+        if (changed) _view->viewport()->update();
+        emit updated();
+        updating_thumbnails = false;
+        return;
+    }
+
     //Dimensions
     int thumbsize = thumbWidth();
     thumbwidth = thumbsize;
@@ -803,22 +1242,126 @@ ThumbnailBox::updateThumbnails()
     rows = rowCount(); //2.9 -> 2
     if (!cols) cols = 1;
     if (!rows) rows = 1;
-    maxthumbs = cols * rows;
-    visiblethumbs = count;
-    if (visiblethumbs > maxthumbs) visiblethumbs = maxthumbs;
     totalrows = count / cols; if (count % cols) totalrows++; //2.1 -> 3
     totalhiddenrows = totalrows - rows;
     if (totalhiddenrows < 0) totalhiddenrows = 0;
 
     //Recreational activities (what)
-    //Everytime an update is triggered,
-    //the thumbnail area widget is recreated
-    //and filled with the visible thumbs, which are also recreated.
-    //This is important for large directories (> 1000 items),
+    //Everytime an update is triggered (scrolling, selection, resize),
+    //the visible thumbs must show the items in the viewport.
+    //Only the visible thumbs exist,
     //because creating 1000 thumbs is inefficient/stupid/sigsegv.
+    //We used to recreate the thumbnail area and all of its thumbs
+    //on every update, which made scrolling stutter.
+    //Now, there's a pool of thumbs, one for each cell in the viewport,
+    //which are bound to other items when scrolling.
+    //The pool is only recreated if the grid changes (resized).
+    if (!thumbarea || _thumb_pool.size() != cols * rows ||
+        _thumb_pool_columns != cols || _thumb_pool_width != thumbwidth)
+    {
+        createThumbPool(cols, rows, QSize(thumbwidth, thumbheight));
+    }
+    scrollbar->setPageStep(rows);
+
+    //Scrollbar position
+    if (totalhiddenrows >= 0) scrollbar->setMaximum(totalhiddenrows);
+    scrollpos = scrollbar->value();
+    hiddenrows = scrollpos;
+    hiddenthumbs = hiddenrows * cols;
+
+    //Items in viewport
+    QStringList visible_paths;
+    for (int i = hiddenthumbs, ii = qMin(count, hiddenthumbs + cols * rows);
+        i < ii; i++)
+        visible_paths << itemPath(i);
 
-    //Clear list of visible thumbnails (recreated below)
+    //New generation if other items are shown
+    //Pending requests of the old items are obsolete
+    bool viewport_changed = visible_paths != _visible_paths;
+    if (viewport_changed)
+    {
+        _visible_paths = visible_paths;
+        _generation++;
+        emit viewportChanged(_generation);
+        trackScroll();
+    }
+    bool flinging = isFlinging();
+    if (flinging) _settle_timer.start();
+
+    //Bind thumbnails to items
     _visible_thumbnails_in_viewport.clear();
+    int index = this->index();
+    for (int i = 0, ii = _thumb_pool.size(); i < ii; i++)
+    {
+        Thumb *thumb = _thumb_pool.at(i);
+        int absindex = hiddenthumbs + i;
+        if (absindex >= count)
+        {
+            //No more thumbs, row not filled
+            thumb->hide();
+            continue;
+        }
+
+        //Item title
+        QString title = itemTitle(absindex);
+
+        //Item state
+        thumb->setIndex(absindex);
+        thumb->setEnabled(itemsClickable());
+        thumb->setFrameShadow(absindex == index ?
+            QFrame::Sunken : QFrame::Raised);
+        thumb->setToolTip(title);
+        QColor clr_bg = fileColor(itemPath(absindex));
+        thumb->setAutoFillBackground(clr_bg.isValid());
+        if (clr_bg.isValid())
+        {
+            QPalette palette = thumb->palette();
+            palette.setColor(QPalette::Window, clr_bg);
+            thumb->setPalette(palette);
+        }
+
+        //Add to list of visible thumbnails
+        _visible_thumbnails_in_viewport[absindex] = thumb;
+
+        //Set title
+        thumb->setTitle(title);
+
+        //Load image (if available)
+        QString path = itemPath(absindex); //path, uri
+        QPixmap cached_pixmap = cachedPixmap(path);
+        thumb->setPixmap(cached_pixmap); //from internal cache or empty
+        thumb->setPlaceholder(cached_pixmap.isNull() ?
+            placeholderColor(path) : QColor());
+        if (cached_pixmap.isNull() && flinging)
+        {
+            //Flying past, requested once scrolling settles
+            _deferred = true;
+        }
+        else if (cached_pixmap.isNull())
+        {
+            //Not cached, request it
+            //It will be drawn later
+            //Request should be processed in background (ideally)
+            requestImage(path);
+        }
+
+        thumb->show();
+    }
+
+    //Request the next items, after the visible ones
+    if (viewport_changed && !flinging) prefetch();
+
+    //Let the world know
+    emit updated();
+
+    //Done
+    updating_thumbnails = false;
+}
+
+void
+ThumbnailBox::createThumbPool(int cols, int rows, const QSize &thumb_size)
+{
+    int padding = 5;
 
     //Recreate thumbnail area
     //The 2013 easter egg:
@@ -828,20 +1371,15 @@ ThumbnailBox::updateThumbnails()
         thumbarea->hide();
         thumbarea->deleteLater();
     }
+    _thumb_pool.clear();
+    _visible_thumbnails_in_viewport.clear();
     thumbarea = new QWidget;
     thumbcontainerlayout->insertWidget(0, thumbarea);
     thumbarea->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    scrollbar->setPageStep(rows);
     QVBoxLayout *vbox_rows = new QVBoxLayout;
     thumbarea->setLayout(vbox_rows);
 
-    //Scrollbar position
-    if (totalhiddenrows >= 0) scrollbar->setMaximum(totalhiddenrows);
-    scrollpos = scrollbar->value();
-    hiddenrows = scrollpos;
-    hiddenthumbs = hiddenrows * cols;
-
-    //Create thumbnails
+    //Create thumbnails (bound to items by updateThumbnails())
     for (int i = 0; i < rows; i++)
     {
         //Row
@@ -849,81 +1387,17 @@ ThumbnailBox::updateThumbnails()
         hbox_row->setSpacing(padding);
         for (int j = 0; j < cols; j++)
         {
-            //Column
-            int relindex = i * cols + j;
-            int absindex = relindex + hiddenthumbs;
-            if (absindex >= count) break; //no more thumbs, row not filled
-            int index = this->index();
-
-            //Item title
-            QString title = itemTitle(absindex);
-
-            //Create item thumbnail object
-            Thumb *thumb = new Thumb(absindex);
-            thumb->setEnabled(itemsClickable());
-            connect(thumb,
-                    SIGNAL(clicked(int)),
-                    SLOT(select(int)));
-            thumb->setFixedSize(QSize(thumbwidth, thumbheight));
+            //Create thumbnail object (not bound to an item yet)
+            Thumb *thumb = new Thumb(-1);
+            thumb->setFixedSize(thumb_size);
             thumb->setFrameStyle(QFrame::Panel | QFrame::Raised);
-            if (absindex == index) thumb->setFrameShadow(QFrame::Sunken);
             thumb->setLineWidth(3);
-            thumb->setToolTip(title);
-            QColor clr_bg = fileColor(itemPath(absindex));
-            if (clr_bg.isValid())
-            {
-                thumb->setAutoFillBackground(true);
-                QPalette palette = thumb->palette();
-                palette.setColor(QPalette::Window, clr_bg);
-                thumb->setPalette(palette);
-            }
+            thumb->hide();
             hbox_row->addWidget(thumb);
-
-            //Add to list of visible thumbnails
-            _visible_thumbnails_in_viewport[absindex] = thumb;
-
-            //Set title
-            thumb->setTitle(title);
-
-            //Load image (if available)
-            QString path = itemPath(absindex); //path, uri
-            QPixmap cached_pixmap = cachedPixmap(path);
-            if (!cached_pixmap.isNull())
-            {
-                //Got it, draw it
-                thumb->setPixmap(cached_pixmap); //from internal cache
-            }
-            else
-            {
-                //Not cached, request it
-                //It will be drawn later
-                //Request should be processed in background (ideally)
-                requestImage(path);
-            }
+            _thumb_pool << thumb;
 
             //Connect thumbnail signals
-            connect(thumb,
-                    SIGNAL(clicked(int)),
-                    SIGNAL(clicked(int)));
-            connect(thumb,
-                    SIGNAL(clicked(int, const QPoint&)),
-                    SIGNAL(clicked(int, const QPoint&)));
-            connect(thumb,
-                    SIGNAL(rightClicked(int)),
-                    SIGNAL(rightClicked(int)));
-            connect(thumb,
-                    SIGNAL(rightClicked(int, const QPoint&)),
-                    SIGNAL(rightClicked(int, const QPoint&)));
-            connect(thumb,
-                    SIGNAL(contextMenuRequested(const QPoint&)),
-                    SIGNAL(contextMenuRequested(const QPoint&)));
-            connect(thumb,
-                    SIGNAL(middleClicked(int)),
-                    SIGNAL(middleClicked(int)));
-            connect(thumb,
-                    SIGNAL(middleClicked(int, const QPoint&)),
-                    SIGNAL(middleClicked(int, const QPoint&)));
-
+            connectThumbSignals(thumb);
         }
 
         //Add row to layout
@@ -932,63 +1406,240 @@ ThumbnailBox::updateThumbnails()
     }
     vbox_rows->addStretch(1);
 
-    //Let the world know
-    emit updated();
-
-    //Done
-    updating_thumbnails = false;
+    _thumb_pool_columns = cols;
+    _thumb_pool_width = thumb_size.width();
 }
 
-/*!
- * This is a convenience function.
- */
 void
-ThumbnailBox::updateThumbnails(int unused)
-{
-    updateThumbnails();
+ThumbnailBox::connectThumbSignals(QObject *thumb)
+{
+    //Forward signals of thumb (Thumb or ThumbView)
+    connect(thumb,
+            SIGNAL(clicked(int)),
+            SLOT(select(int)));
+    connect(thumb,
+            SIGNAL(clicked(int)),
+            SIGNAL(clicked(int)));
+    connect(thumb,
+            SIGNAL(clicked(int, const QPoint&)),
+            SIGNAL(clicked(int, const QPoint&)));
+    connect(thumb,
+            SIGNAL(rightClicked(int)),
+            SIGNAL(rightClicked(int)));
+    connect(thumb,
+            SIGNAL(rightClicked(int, const QPoint&)),
+            SIGNAL(rightClicked(int, const QPoint&)));
+    connect(thumb,
+            SIGNAL(contextMenuRequested(const QPoint&)),
+            SIGNAL(contextMenuRequested(const QPoint&)));
+    connect(thumb,
+            SIGNAL(middleClicked(int)),
+            SIGNAL(middleClicked(int)));
+    connect(thumb,
+            SIGNAL(middleClicked(int, const QPoint&)),
+            SIGNAL(middleClicked(int, const QPoint&)));
+}
+
+bool
+ThumbnailBox::updateVisibleItems()
+{
+    //Items in viewport (painted view)
+    QStringList visible_paths;
+    foreach (int index, visibleIndexes())
+        visible_paths << itemPath(index);
+    if (visible_paths == _visible_paths) return false;
+
+    //New generation, pending requests of the old items are obsolete
+    _visible_paths = visible_paths;
+    _generation++;
+    emit viewportChanged(_generation);
+
+    //Flying past (fling), show what's cached, request nothing
+    trackScroll();
+    if (isFlinging())
+    {
+        _deferred = true;
+        _settle_timer.start();
+        return true;
+    }
+
+    //Request missing images
+    foreach (QString path, visible_paths)
+    {
+        if (!_pixcache.contains(path)) requestImage(path);
+    }
+
+    //Request the next items
+    prefetch();
+
+    return true;
 }
 
 /*!
- * This is a convenience function.
+ * Returns true if the scrollbar is being dragged fast
+ * (more than a screen per second).
+ *
+ * Images are not requested while flinging, only cached ones are shown.
+ * The visible ones are requested when the scrollbar is released or
+ * hasn't moved for a moment (settleScrolling()).
  */
-void
-ThumbnailBox::scheduleUpdateThumbnails(int timeout)
+bool
+ThumbnailBox::isFlinging()
+const
 {
-    if (timeout < 0) timeout = 0;
-    QTimer::singleShot(timeout, this, SLOT(updateThumbnails()));
+    QScrollBar *bar = _view ? _view->verticalScrollBar() : scrollbar;
+    if (!bar->isSliderDown()) return false;
+    return qAbs(_scroll_velocity) > qMax(rowCount(), 1);
 }
 
 /*!
- * Sets the size of the thumbnails, relative to the available space.
- * The provided percentage should be a value between 0 and 1.
+ * Requests the images that have been deferred while flinging.
  */
 void
-ThumbnailBox::setThumbSize(double percent)
+ThumbnailBox::settleScrolling()
 {
-    if (percent < 0) percent = 0;
-    if (percent > 1) percent = 1;
-    _size = percent;
+    _settle_timer.stop();
+    if (!_deferred) return;
+    _deferred = false;
 
+    //Not moving anymore, update as if scrolled to this position
+    _scroll_velocity = 0;
+    _visible_paths.clear();
     updateThumbnails();
-
-    setMinimumHeight(thumbWidth() * 1.5);
 }
 
 /*!
- * This is a convenience function.
- * The percentage must be an integer between 1 and 100.
+ * Measures the scroll speed (rows per second) and direction.
+ * Called when the viewport has changed.
  */
 void
-ThumbnailBox::setThumbSize(int percent)
+ThumbnailBox::trackScroll()
 {
-    if (percent < 1) percent = 1; //minimum 1%
-    if (percent >= 100) percent = 100; //maximum 100%
+    qint64 now = _clock.elapsed();
+    int top_row = topRow();
+    int rows = top_row - _last_top_row;
+    qint64 elapsed = qMax(now - _last_scroll_time, (qint64)1);
 
-    setThumbSize((double)percent / 100);
+    //Moving average, reset after a pause
+    if (rows)
+    {
+        double velocity = rows * 1000. / elapsed;
+        if (elapsed > 1000) _scroll_velocity = velocity;
+        else _scroll_velocity = .5 * _scroll_velocity + .5 * velocity;
+        _scroll_direction = rows > 0 ? 1 : -1;
+    }
+    else if (elapsed > 1000)
+    {
+        _scroll_velocity = 0;
+    }
+
+    _last_top_row = top_row;
+    _last_scroll_time = now;
 }
 
 /*!
- * Sets the absolute width of the thumbnails.
+ * Requests images of the items next to the viewport (low priority).
+ *
+ * The rows in scroll direction are requested first, as many as will
+ * scroll into view while an image is being loaded (at least one),
+ * then a few rows in the opposite direction.
+ * The number of requested items is limited by the cache size,
+ * so prefetched images don't evict the visible ones.
+ * Only asynchronous sources (External) are prefetched.
+ */
+void
+ThumbnailBox::prefetch()
+{
+    if (sourceType() != SourceType::External) return;
+    QList<int> visible_indexes = visibleIndexes();
+    if (visible_indexes.isEmpty()) return;
+    int cols = qMax(columnCount(), 1);
+    int rows = qMax(rowCount(), 1);
+
+    //Rows ahead (scroll speed * latency) and behind
+    double speed = qAbs(_scroll_velocity);
+    int ahead = qCeil(speed * _decode_latency / 1000) + 1;
+    ahead = qMin(ahead, 3 * rows);
+    int behind = qMax(ahead / 4, 1);
+    if (!_scroll_direction) behind = ahead;
+
+    //Cache budget: prefetched images are new, they go to the FIFO queue
+    //and would push the visible ones out (that aren't in the main queue)
+    //if more were requested than its share minus the visible items
+    qint64 capacity = _pixcache.inMaxCost() / qMax(thumbnailCost(), (qint64)1);
+    qint64 budget = capacity - visible_indexes.size();
+
+    //Items, nearest first
+    int first = visible_indexes.first();
+    int last = visible_indexes.last();
+    bool down = _scroll_direction >= 0;
+    QList<int> indexes;
+    for (int i = 1; i <= ahead * cols; i++)
+        indexes << (down ? last + i : first - i);
+    for (int i = 1; i <= behind * cols; i++)
+        indexes << (down ? first - i : last + i);
+
+    //Request
+    foreach (int index, indexes)
+    {
+        if (budget <= 0) break;
+        if (!isValidIndex(index)) continue;
+        budget--;
+        QString path = itemPath(index);
+        if (!_pixcache.contains(path)) requestImage(path, Priority::Prefetch);
+    }
+}
+
+/*!
+ * This is a convenience function.
+ */
+void
+ThumbnailBox::updateThumbnails(int unused)
+{
+    updateThumbnails();
+}
+
+/*!
+ * This is a convenience function.
+ */
+void
+ThumbnailBox::scheduleUpdateThumbnails(int timeout)
+{
+    if (timeout < 0) timeout = 0;
+    QTimer::singleShot(timeout, this, SLOT(updateThumbnails()));
+}
+
+/*!
+ * Sets the size of the thumbnails, relative to the available space.
+ * The provided percentage should be a value between 0 and 1.
+ */
+void
+ThumbnailBox::setThumbSize(double percent)
+{
+    if (percent < 0) percent = 0;
+    if (percent > 1) percent = 1;
+    _size = percent;
+
+    updateThumbnails();
+
+    setMinimumHeight(thumbWidth() * 1.5);
+}
+
+/*!
+ * This is a convenience function.
+ * The percentage must be an integer between 1 and 100.
+ */
+void
+ThumbnailBox::setThumbSize(int percent)
+{
+    if (percent < 1) percent = 1; //minimum 1%
+    if (percent >= 100) percent = 100; //maximum 100%
+
+    setThumbSize((double)percent / 100);
+}
+
+/*!
+ * Sets the absolute width of the thumbnails.
  */
 void
 ThumbnailBox::setThumbWidth(int width)
@@ -1010,8 +1661,16 @@ ThumbnailBox::select(int index, bool send_signal)
 
     if (!isValidIndex(index)) index = -1;
     if (index == this->index()) return; //don't re-select selected item
+    int old_index = _index;
     _index = index;
 
+    //Painted view, repaint both items
+    if (_view)
+    {
+        _view->updateItem(old_index);
+        _view->updateItem(index);
+    }
+
     //The 2013 easter egg:
     //We realize that closing the "File not found" message box
     //after clicking on a non-existent thumbnail causes a SIGSEGV.
@@ -1140,6 +1799,8 @@ ThumbnailBox::clear()
     //Clear list
     QStringList &list = _list;
     list.clear();
+    _item_indexes.clear();
+    _placeholder_colors.clear();
 
     //Cache not cleared by default, could be reused
 
@@ -1176,20 +1837,8 @@ ThumbnailBox::setList(const QStringList &paths, int selected, SourceType type)
 
     //Check and add provided paths to list of thumbnails
     QStringList &list = _list;
-    foreach (QString path, paths)
-    {
-        if (type == SourceType::Local)
-        {
-            QFileInfo inf(path);
-            if ((!inf.isFile()) &&
-                (!inf.isDir() || !directoriesVisible()))
-            {
-                continue; //not found, ignore invalid entry
-            }
-            path = inf.absoluteFilePath(); //full local path
-        }
-        list << path;
-    }
+    list = checkedPaths(paths);
+    indexItems();
 
     //Re-enable
     setEnabled(true);
@@ -1249,6 +1898,7 @@ ThumbnailBox::setList(const QStringList &remote_paths,
     //Set list
     QStringList &list = _list;
     list = remote_paths;
+    indexItems();
 
     //Re-enable
     setEnabled(true);
@@ -1262,6 +1912,99 @@ ThumbnailBox::setList(const QStringList &remote_paths,
     return true;
 }
 
+/*!
+ * Appends the given items to the list of thumbnails,
+ * using the source type that's already set.
+ *
+ * The selection and the scroll position are kept.
+ * The thumbnails are only recreated if new items
+ * show up in the viewport, otherwise only the scrollbar is updated.
+ * So appending lots of small batches to a long list is cheap.
+ */
+bool
+ThumbnailBox::append(const QStringList &paths)
+{
+    //Check and add provided paths to list of thumbnails
+    QStringList new_items = checkedPaths(paths);
+    if (new_items.isEmpty()) return false;
+    int old_count = count();
+    _list << new_items;
+    indexItems(old_count);
+
+    //Numbers
+    int cols = columnCount();
+    int rows = rowCount();
+    if (!cols) cols = 1;
+    if (!rows) rows = 1;
+    int count = this->count();
+    int totalrows = count / cols; if (count % cols) totalrows++;
+    int totalhiddenrows = totalrows - rows;
+    if (totalhiddenrows < 0) totalhiddenrows = 0;
+
+    //Update scrollbar range (doesn't move the scrollbar)
+    scrollbar->setMaximum(totalhiddenrows);
+
+    //Draw thumbnails if viewport wasn't full
+    //The painted view has its own scroll range, it's always updated
+    //(and only repainted if new items are visible)
+    int viewport_end = (topRow() + rows) * cols;
+    if (old_count < viewport_end || _view)
+        scheduleUpdateThumbnails(0);
+
+    return true;
+}
+
+/*!
+ * Removes the given items from the list of thumbnails.
+ *
+ * The selection is kept, unless the selected item is removed.
+ * Returns false if none of the items were in the list.
+ */
+bool
+ThumbnailBox::remove(const QStringList &paths)
+{
+    //Look up removed items, the items before the first one stay
+    QSet<QString> removed_items;
+    int first = count();
+    foreach (QString path, paths)
+    {
+        int i = indexOf(path);
+        if (i == -1) continue;
+        removed_items.insert(path);
+        first = qMin(first, i);
+    }
+    if (removed_items.isEmpty()) return false;
+
+    //Remove items, keep track of the selected one
+    int index = this->index();
+    int new_index = index;
+    int j = first;
+    for (int i = first, ii = count(); i < ii; i++)
+    {
+        if (!removed_items.contains(_list.at(i)))
+        {
+            if (j != i) _list[j] = _list.at(i);
+            j++;
+            continue;
+        }
+        if (i < index) new_index--;
+        else if (i == index) new_index = -1;
+    }
+    _list.erase(_list.begin() + j, _list.end());
+    _index = new_index;
+
+    //Forget removed items, move the others
+    foreach (QString path, removed_items)
+        _item_indexes.remove(path);
+    indexItems(first);
+
+    //Redraw thumbnails
+    scheduleUpdateThumbnails(0);
+
+    if (new_index != index) emit selectionChanged();
+    return true;
+}
+
 ThumbnailBoxComponents::Thumb::Thumb(int index, QWidget *parent)
                       : QFrame(parent),
                         index(index)
@@ -1269,7 +2012,8 @@ ThumbnailBoxComponents::Thumb::Thumb(int index, QWidget *parent)
     //Create layout
     QVBoxLayout *vbox = new QVBoxLayout;
     lbl_preview = new QLabel;
-    lbl_preview->setScaledContents(true);
+    lbl_preview->setAlignment(Qt::AlignCenter); //already scaled
+    lbl_preview->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
     vbox->addWidget(lbl_preview);
     lbl_title = new QLabel;
     lbl_title->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Fixed);
@@ -1278,10 +2022,36 @@ ThumbnailBoxComponents::Thumb::Thumb(int index, QWidget *parent)
 
 }
 
+/*!
+ * Binds this thumbnail to the item at index (thumbnails are recycled).
+ */
+void
+ThumbnailBoxComponents::Thumb::setIndex(int index)
+{
+    this->index = index;
+}
+
 void
 ThumbnailBoxComponents::Thumb::setPixmap(const QPixmap &preview)
 {
     lbl_preview->setPixmap(preview);
+    if (!preview.isNull()) setPlaceholder(QColor());
+}
+
+/*!
+ * Fills the preview area with color while there's no preview.
+ * An invalid color removes the placeholder.
+ */
+void
+ThumbnailBoxComponents::Thumb::setPlaceholder(const QColor &color)
+{
+    if (color.isValid())
+    {
+        QPalette palette = lbl_preview->palette();
+        palette.setColor(QPalette::Window, color);
+        lbl_preview->setPalette(palette);
+    }
+    lbl_preview->setAutoFillBackground(color.isValid());
 }
 
 void
@@ -1296,6 +2066,9 @@ ThumbnailBoxComponents::Thumb::mousePressEvent(QMouseEvent *event)
     //The 2013 easter egg:
     //It (SIGSEGV) is triggered by those signals,
     //because the widgets have been deleted by the update function.
+    //Thumbs are recycled now, a receiver might bind this one
+    //to another item while these signals are emitted (local copy of index).
+    int index = this->index;
 
     if (event->button() == Qt::LeftButton)
     {
@@ -1316,3 +2089,658 @@ ThumbnailBoxComponents::Thumb::mousePressEvent(QMouseEvent *event)
     event->accept();
 }
 
+
+/*! \class ThumbnailBoxComponents::ThumbView
+ *
+ * \brief The ThumbView class paints the thumbnails of a ThumbnailBox
+ * in a single widget (ThumbnailBox::ViewMode::Painted).
+ *
+ * There are no widgets per thumbnail. The visible thumbnails are painted
+ * directly from the cache, clicks are mapped to items (itemAt()).
+ * The scrollbar is measured in pixels, so scrolling is smooth.
+ * Scrolling moves the painted area, only the uncovered part
+ * is repainted. A loaded image only repaints its own thumbnail.
+ *
+ */
+
+ThumbnailBoxComponents::ThumbView::ThumbView(ThumbnailBox *box)
+                          : QAbstractScrollArea(box),
+                            _box(box),
+                            _columns(1),
+                            _cell_size(0),
+                            _thumb_size(0),
+                            _count(0)
+{
+    setFrameStyle(QFrame::NoFrame);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
+    viewport()->setBackgroundRole(QPalette::Window);
+    viewport()->setAutoFillBackground(true); //opaque, scrolls cheaply
+}
+
+/*!
+ * Returns the index of the item at pos (viewport coordinates)
+ * or -1 if there's none.
+ */
+int
+ThumbnailBoxComponents::ThumbView::itemAt(const QPoint &pos)
+const
+{
+    if (!_cell_size) return -1;
+    int y = pos.y() + verticalScrollBar()->value();
+    int col = pos.x() / _cell_size;
+    int row = y / _cell_size;
+    if (pos.x() < 0 || y < 0 || col >= _columns) return -1;
+    int index = row * _columns + col;
+    if (index >= _count) return -1;
+    if (!itemRect(index).contains(pos)) return -1; //padding
+    return index;
+}
+
+/*!
+ * Returns the rectangle of the item at index (viewport coordinates).
+ */
+QRect
+ThumbnailBoxComponents::ThumbView::itemRect(int index)
+const
+{
+    if (index < 0 || !_cell_size) return QRect();
+    int row = index / _columns;
+    int col = index % _columns;
+    int y = row * _cell_size - verticalScrollBar()->value();
+    return QRect(col * _cell_size, y, _thumb_size, _thumb_size);
+}
+
+/*!
+ * Returns the indexes of the items that are (partially) visible.
+ */
+QList<int>
+ThumbnailBoxComponents::ThumbView::visibleIndexes()
+const
+{
+    QList<int> indexes;
+    if (!_cell_size) return indexes;
+    int offset = verticalScrollBar()->value();
+    int first_row = offset / _cell_size;
+    int last_row = (offset + viewport()->height() - 1) / _cell_size;
+    int first = first_row * _columns;
+    int end = qMin((last_row + 1) * _columns, _count);
+    for (int i = first; i < end; i++)
+        indexes << i;
+    return indexes;
+}
+
+/*!
+ * Returns the first (partially) visible row.
+ */
+int
+ThumbnailBoxComponents::ThumbView::topRow()
+const
+{
+    if (!_cell_size) return 0;
+    return verticalScrollBar()->value() / _cell_size;
+}
+
+/*!
+ * Updates the grid (columns, thumbnail size) and the scroll range.
+ * Returns true if the grid has changed, which requires a full repaint.
+ */
+bool
+ThumbnailBoxComponents::ThumbView::layoutItems()
+{
+    //Same dimensions as the thumbnail widgets
+    int padding = 5;
+    int thumb_size = _box->thumbWidth();
+    int columns = qMax(_box->columnCount(), 1);
+    int count = _box->count();
+    bool changed = thumb_size != _thumb_size || columns != _columns;
+    _thumb_size = thumb_size;
+    _cell_size = thumb_size + padding;
+    _columns = columns;
+    _count = count;
+
+    //Scroll range (pixels)
+    int rows = count / columns + (count % columns ? 1 : 0);
+    int height = rows * _cell_size;
+    QScrollBar *bar = verticalScrollBar();
+    bar->setRange(0, qMax(height - viewport()->height(), 0));
+    bar->setPageStep(viewport()->height());
+    bar->setSingleStep(qMax(_cell_size / 4, 1));
+
+    return changed;
+}
+
+/*!
+ * Repaints the item at index, if it's visible.
+ */
+void
+ThumbnailBoxComponents::ThumbView::updateItem(int index)
+{
+    if (index < 0 || index >= _count) return;
+    QRect rect = itemRect(index);
+    if (rect.intersects(viewport()->rect()))
+        viewport()->update(rect);
+}
+
+/*!
+ * Scrolls to row (the top of the row).
+ */
+void
+ThumbnailBoxComponents::ThumbView::scrollToRow(int row)
+{
+    verticalScrollBar()->setValue(row * _cell_size);
+}
+
+void
+ThumbnailBoxComponents::ThumbView::paintEvent(QPaintEvent *event)
+{
+    //Paint items in dirty region only
+    QPainter painter(viewport());
+    QRect dirty = event->rect();
+    foreach (int index, visibleIndexes())
+    {
+        QRect rect = itemRect(index);
+        if (!rect.intersects(dirty)) continue;
+        paintItem(painter, index, rect);
+    }
+}
+
+void
+ThumbnailBoxComponents::ThumbView::paintItem(QPainter &painter,
+                                             int index,
+                                             const QRect &rect)
+{
+    QString path = _box->itemPath(index);
+    QString title = _box->itemTitle(index);
+    bool selected = index == _box->index();
+
+    //Background (custom color)
+    QColor clr_bg = _box->fileColor(path);
+    if (clr_bg.isValid()) painter.fillRect(rect, clr_bg);
+
+    //Frame, sunken if selected (like a thumbnail widget)
+    qDrawShadePanel(&painter, rect, palette(), selected, 3);
+
+    //Title at the bottom
+    QRect inner = rect.adjusted(9, 9, -9, -9);
+    int title_height = fontMetrics().height();
+    QRect title_rect(inner.left(), inner.bottom() - title_height + 1,
+        inner.width(), title_height);
+    painter.setPen(palette().color(QPalette::WindowText));
+    painter.drawText(title_rect, Qt::AlignLeft | Qt::AlignVCenter,
+        fontMetrics().elidedText(title, Qt::ElideRight, title_rect.width()));
+
+    //Preview above (not requested here, see ThumbnailBox)
+    QRect preview_rect = inner.adjusted(0, 0, 0, -title_height - 6);
+    QPixmap pixmap = _box->cachedPixmap(path);
+    QColor placeholder = pixmap.isNull() ?
+        _box->placeholderColor(path) : QColor();
+    if (placeholder.isValid() && preview_rect.isValid())
+        painter.fillRect(preview_rect, placeholder); //loading
+    if (!pixmap.isNull() && preview_rect.isValid())
+    {
+        QSize size = pixmap.size();
+        size.scale(preview_rect.size(), Qt::KeepAspectRatio);
+        QRect target(QPoint(), size);
+        target.moveCenter(preview_rect.center());
+        painter.drawPixmap(target, pixmap);
+    }
+}
+
+void
+ThumbnailBoxComponents::ThumbView::mousePressEvent(QMouseEvent *event)
+{
+    //Item under cursor, like Thumb::mousePressEvent()
+    int index = itemAt(event->pos());
+    if (index == -1 || !_box->itemsClickable())
+    {
+        event->ignore();
+        return;
+    }
+
+    if (event->button() == Qt::LeftButton)
+    {
+        emit clicked(index);
+        emit clicked(index, event->globalPos());
+    }
+    else if (event->button() == Qt::RightButton)
+    {
+        emit rightClicked(index);
+        emit rightClicked(index, event->globalPos());
+        emit contextMenuRequested(event->globalPos());
+    }
+    else if (event->button() == Qt::MidButton)
+    {
+        emit middleClicked(index);
+        emit middleClicked(index, event->globalPos());
+    }
+    event->accept();
+}
+
+void
+ThumbnailBoxComponents::ThumbView::resizeEvent(QResizeEvent *event)
+{
+    //Grid depends on width
+    QAbstractScrollArea::resizeEvent(event);
+    _box->updateThumbnails();
+}
+
+void
+ThumbnailBoxComponents::ThumbView::scrollContentsBy(int dx, int dy)
+{
+    //Move painted area, the uncovered part is repainted
+    viewport()->scroll(dx, dy);
+
+    //Request images of the items that are visible now
+    _box->updateVisibleItems();
+}
+
+/*! \class ThumbnailBoxComponents::ImageCache
+ *
+ * \brief The ImageCache class caches thumbnail images, like QCache,
+ * using a scan-resistant eviction policy (2Q).
+ *
+ * New images go to a small FIFO queue (a quarter of the cache).
+ * Images evicted from it are remembered for a while (keys only).
+ * If such an image is inserted again, it's been used more than once
+ * and goes to the main queue (LRU). Images in the main queue are only
+ * evicted once the FIFO queue is within its share.
+ * So scrolling through the whole list once only churns the FIFO queue,
+ * it doesn't evict the thumbnails around the current picture.
+ *
+ * Lookups (object()) count as use, contains() doesn't.
+ *
+ * Evicted images are not dropped right away, they can be compressed
+ * and kept in a warm tier with its own limit (setWarmMaxCost()),
+ * least recently evicted ones are dropped first. A compressed
+ * thumbnail takes about a tenth of the memory.
+ * The cache doesn't compress anything itself, that would block
+ * the thread using it (the gui): the evicted images are handed out
+ * (takeEvicted()) and the compressed data is passed back
+ * (insertCompressed()), unless the image has been inserted
+ * or removed meanwhile. Likewise, compressed images are not returned
+ * by object() (and contains() doesn't count them), they're
+ * decompressed elsewhere (compressedObject()) and put back (restore()).
+ * That's still a lot cheaper than loading the picture file again.
+ * See ImageCodec.
+ *
+ */
+
+ThumbnailBoxComponents::ImageCache::ImageCache(int max_cost)
+                                  : _max_cost(max_cost),
+                                    _warm_max_cost(0),
+                                    _warm_cost(0),
+                                    _total_cost(0),
+                                    _in_cost(0),
+                                    _clock(0)
+{
+}
+
+int
+ThumbnailBoxComponents::ImageCache::maxCost()
+const
+{
+    return _max_cost;
+}
+
+/*!
+ * Returns the share of the FIFO queue, new images are evicted
+ * once they exceed it (unless they're used again).
+ */
+int
+ThumbnailBoxComponents::ImageCache::inMaxCost()
+const
+{
+    return _max_cost / 4;
+}
+
+int
+ThumbnailBoxComponents::ImageCache::totalCost()
+const
+{
+    return _total_cost;
+}
+
+int
+ThumbnailBoxComponents::ImageCache::warmMaxCost()
+const
+{
+    return _warm_max_cost;
+}
+
+/*!
+ * Returns the size of the compressed images.
+ */
+int
+ThumbnailBoxComponents::ImageCache::warmCost()
+const
+{
+    return _warm_cost;
+}
+
+/*!
+ * Returns the number of images, not including compressed ones.
+ */
+int
+ThumbnailBoxComponents::ImageCache::count()
+const
+{
+    return _entries.size();
+}
+
+/*!
+ * Returns true if an image is cached for key (not compressed).
+ */
+bool
+ThumbnailBoxComponents::ImageCache::contains(const QString &key)
+const
+{
+    return _entries.contains(key);
+}
+
+/*!
+ * Returns true if a compressed image is cached for key.
+ */
+bool
+ThumbnailBoxComponents::ImageCache::containsCompressed(const QString &key)
+const
+{
+    return _warm.contains(key);
+}
+
+/*!
+ * Returns the image cached for key or an empty image.
+ * Compressed images are not returned, see compressedObject().
+ */
+QImage
+ThumbnailBoxComponents::ImageCache::object(const QString &key)
+{
+    QHash<QString, Entry>::iterator it = _entries.find(key);
+    if (it == _entries.end()) return QImage();
+
+    //Move to front of main queue (LRU), FIFO queue keeps its order
+    Entry &entry = it.value();
+    if (entry.queue == Main)
+    {
+        _main_queue.remove(entry.stamp);
+        entry.stamp = ++_clock;
+        _main_queue.insert(entry.stamp, key);
+    }
+
+    return entry.image;
+}
+
+/*!
+ * Returns the compressed image cached for key or an empty byte array.
+ * Once it's been decompressed, it should be put back with restore().
+ */
+QByteArray
+ThumbnailBoxComponents::ImageCache::compressedObject(const QString &key)
+const
+{
+    return _warm.value(key).data;
+}
+
+/*!
+ * Inserts image, replacing the image cached for key.
+ * Returns false if it's too big, it's not cached then.
+ */
+bool
+ThumbnailBoxComponents::ImageCache::insert(const QString &key,
+                                           const QImage &image,
+                                           int cost)
+{
+    //Replaced images keep their queue, remembered ones are promoted
+    Queue queue = In;
+    if (_entries.contains(key))
+        queue = _entries.value(key).queue;
+    else if (_ghosts.contains(key))
+        queue = Main;
+    takeWarm(key); //outdated
+    _evicted.remove(key);
+    _compressing.remove(key);
+
+    return store(key, image, cost, queue);
+}
+
+/*!
+ * Inserts the compressed version of an image that has been evicted
+ * (see takeEvicted()), least recently evicted ones are dropped
+ * to make room.
+ * Returns false if it's outdated (the image has been inserted again
+ * or removed meanwhile) or too big, it's not cached then.
+ */
+bool
+ThumbnailBoxComponents::ImageCache::insertCompressed(const QString &key,
+                                                     const QByteArray &data)
+{
+    if (!_compressing.remove(key)) return false;
+    if (data.isEmpty() || data.size() > _warm_max_cost) return false;
+
+    //Make room, least recently evicted ones first
+    takeWarm(key);
+    trimWarm(_warm_max_cost - data.size());
+    WarmEntry entry;
+    entry.data = data;
+    entry.stamp = ++_clock;
+    _warm.insert(key, entry);
+    _warm_queue.insert(entry.stamp, key);
+    _warm_cost += data.size();
+
+    return true;
+}
+
+/*!
+ * Replaces the compressed image cached for key with image,
+ * which should be its decompressed version.
+ * It's been used again, so it goes to the main queue.
+ * Returns false if there's no compressed image for key (anymore)
+ * or if an image has been inserted meanwhile, nothing is changed then.
+ */
+bool
+ThumbnailBoxComponents::ImageCache::restore(const QString &key,
+                                            const QImage &image)
+{
+    if (_entries.contains(key) || !_warm.contains(key)) return false;
+    takeWarm(key);
+    if (image.isNull()) return false; //broken, dropped
+
+    return store(key, image, image.byteCount(), Main);
+}
+
+/*!
+ * Returns the images that have been evicted since the last call,
+ * if there's a warm tier. Their compressed versions should be passed
+ * to insertCompressed().
+ */
+QHash<QString, QImage>
+ThumbnailBoxComponents::ImageCache::takeEvicted()
+{
+    QHash<QString, QImage> images = _evicted;
+    _evicted.clear();
+    foreach (QString key, images.keys())
+        _compressing.insert(key);
+    return images;
+}
+
+bool
+ThumbnailBoxComponents::ImageCache::store(const QString &key,
+                                          const QImage &image,
+                                          int cost,
+                                          Queue queue)
+{
+    take(key);
+    forget(key);
+    if (cost > _max_cost) return false;
+
+    //Make room
+    trim(_max_cost - cost);
+
+    //Insert
+    Entry entry;
+    entry.image = image;
+    entry.cost = cost;
+    entry.queue = queue;
+    entry.stamp = ++_clock;
+    _entries.insert(key, entry);
+    if (queue == In) _in_queue.insert(entry.stamp, key);
+    else _main_queue.insert(entry.stamp, key);
+    _total_cost += cost;
+    if (queue == In) _in_cost += cost;
+
+    return true;
+}
+
+void
+ThumbnailBoxComponents::ImageCache::remove(const QString &key)
+{
+    take(key);
+    forget(key);
+    takeWarm(key);
+    _evicted.remove(key);
+    _compressing.remove(key);
+}
+
+void
+ThumbnailBoxComponents::ImageCache::clear()
+{
+    _entries.clear();
+    _in_queue.clear();
+    _main_queue.clear();
+    _ghosts.clear();
+    _ghost_queue.clear();
+    _warm.clear();
+    _warm_queue.clear();
+    _evicted.clear();
+    _compressing.clear();
+    _total_cost = 0;
+    _in_cost = 0;
+    _warm_cost = 0;
+}
+
+/*!
+ * Sets the maximum total cost, images are evicted if necessary.
+ */
+void
+ThumbnailBoxComponents::ImageCache::setMaxCost(int max_cost)
+{
+    _max_cost = max_cost;
+    trim(max_cost);
+}
+
+/*!
+ * Sets the maximum size of the compressed images (warm tier).
+ * 0 disables the warm tier, evicted images are dropped.
+ */
+void
+ThumbnailBoxComponents::ImageCache::setWarmMaxCost(int max_cost)
+{
+    _warm_max_cost = max_cost;
+    trimWarm(max_cost);
+    if (!max_cost) _evicted.clear();
+}
+
+void
+ThumbnailBoxComponents::ImageCache::take(const QString &key)
+{
+    if (!_entries.contains(key)) return;
+    Entry entry = _entries.take(key);
+    if (entry.queue == In)
+    {
+        _in_queue.remove(entry.stamp);
+        _in_cost -= entry.cost;
+    }
+    else
+    {
+        _main_queue.remove(entry.stamp);
+    }
+    _total_cost -= entry.cost;
+}
+
+void
+ThumbnailBoxComponents::ImageCache::trim(int max_cost)
+{
+    while (_total_cost > max_cost && !_entries.isEmpty())
+    {
+        //Evict from FIFO queue if it exceeds its share, remember key
+        if (!_in_queue.isEmpty() &&
+            (_in_cost > inMaxCost() || _main_queue.isEmpty()))
+        {
+            QString key = _in_queue.begin().value();
+            if (_warm_max_cost) _evicted.insert(key, _entries.value(key).image);
+            take(key);
+            qint64 stamp = ++_clock;
+            _ghosts.insert(key, stamp);
+            _ghost_queue.insert(stamp, key);
+        }
+        //Evict least recently used image from main queue
+        else
+        {
+            QString key = _main_queue.begin().value();
+            if (_warm_max_cost) _evicted.insert(key, _entries.value(key).image);
+            take(key);
+        }
+    }
+
+    //Remember about as many keys as there are images
+    while (_ghost_queue.size() > qMax(_entries.size(), 64))
+    {
+        QString key = _ghost_queue.begin().value();
+        forget(key);
+    }
+}
+
+void
+ThumbnailBoxComponents::ImageCache::forget(const QString &key)
+{
+    if (!_ghosts.contains(key)) return;
+    _ghost_queue.remove(_ghosts.take(key));
+}
+
+QByteArray
+ThumbnailBoxComponents::ImageCache::takeWarm(const QString &key)
+{
+    if (!_warm.contains(key)) return QByteArray();
+    WarmEntry entry = _warm.take(key);
+    _warm_queue.remove(entry.stamp);
+    _warm_cost -= entry.data.size();
+    return entry.data;
+}
+
+void
+ThumbnailBoxComponents::ImageCache::trimWarm(int max_cost)
+{
+    while (_warm_cost > max_cost && !_warm_queue.isEmpty())
+    {
+        QString key = _warm_queue.begin().value();
+        takeWarm(key);
+    }
+}
+
+/*! \class ThumbnailBoxComponents::ImageCodec
+ *
+ * \brief The ImageCodec class compresses and decompresses
+ * cached thumbnails in another thread, see ImageCache.
+ *
+ */
+
+void
+ThumbnailBoxComponents::ImageCodec::compress(const QString &key,
+                                             const QImage &image)
+{
+    //Jpeg is small and fast, alpha channel requires png
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    if (image.hasAlphaChannel()) image.save(&buffer, "PNG");
+    else image.save(&buffer, "JPEG", 85);
+
+    emit compressed(key, data); //empty on error, not cached then
+}
+
+void
+ThumbnailBoxComponents::ImageCodec::decompress(const QString &key,
+                                               const QByteArray &data)
+{
+    emit decompressed(key, QImage::fromData(data));
+}
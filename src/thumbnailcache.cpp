@@ -0,0 +1,263 @@
+#include "thumbnailcache.hpp"
+
+/*! \class ThumbnailCache
+ *
+ * \brief The ThumbnailCache class stores thumbnails on disk,
+ * as defined by the freedesktop.org thumbnail specification.
+ *
+ * Thumbnails are png files in the normal (128x128) or large (256x256)
+ * subdirectory of the cache directory (~/.cache/thumbnails).
+ * The file name is the MD5 hash of the uri of the picture file.
+ * Each thumbnail contains the uri and the modification time
+ * of its picture file, so a thumbnail of a file that has been changed
+ * is not used (it's replaced).
+ *
+ * This directory is shared with other applications (file managers),
+ * so thumbnails generated by them are used as well.
+ *
+ * The cache is disabled unless a directory is set (setDirectory()).
+ *
+ */
+
+QString ThumbnailCache::_directory;
+
+/*!
+ * Returns the thumbnail directory defined by the specification
+ * ($XDG_CACHE_HOME/thumbnails) or an empty string on Windows.
+ */
+QString
+ThumbnailCache::defaultDirectory()
+{
+    QString path;
+
+    #if !defined(_WIN32)
+    QString cache_home = QFile::decodeName(qgetenv("XDG_CACHE_HOME"));
+    if (!QDir::isAbsolutePath(cache_home))
+        cache_home = QDir::homePath() + "/.cache";
+    path = cache_home + "/thumbnails";
+    #endif
+
+    return path;
+}
+
+/*!
+ * Returns the cache directory, an empty string if the cache is disabled.
+ */
+QString
+ThumbnailCache::directory()
+{
+    return _directory;
+}
+
+/*!
+ * Sets the cache directory (empty string to disable the cache).
+ * This is shared by all loaders,
+ * it must not be changed while thumbnails are being loaded.
+ */
+void
+ThumbnailCache::setDirectory(const QString &path)
+{
+    _directory = path;
+}
+
+/*!
+ * Returns the size of the cached thumbnail (128 or 256)
+ * to be used for thumbnails fitting into max_size.
+ * Returns 0 if they're too big to be cached.
+ */
+int
+ThumbnailCache::thumbnailSize(const QSize &max_size)
+{
+    int max = qMax(max_size.width(), max_size.height());
+    if (max <= 128) return 128;
+    if (max <= 256) return 256;
+    return 0;
+}
+
+/*!
+ * Returns the file name of the thumbnail (size 128 or 256)
+ * of the picture file at path.
+ * Returns an empty string if the cache is disabled.
+ */
+QString
+ThumbnailCache::fileName(const QString &path, int size)
+{
+    if (_directory.isEmpty()) return QString();
+    if (size != 128 && size != 256) return QString();
+
+    QString hash = QCryptographicHash::hash(uri(path),
+        QCryptographicHash::Md5).toHex();
+    QString subdir = size == 128 ? "normal" : "large";
+    return _directory + "/" + subdir + "/" + hash + ".png";
+}
+
+/*!
+ * Returns true if there's a valid thumbnail of the picture file at path,
+ * to be shown in max_size. Only the header of the thumbnail is read.
+ */
+bool
+ThumbnailCache::contains(const QString &path, const QSize &max_size)
+{
+    QString file = fileName(path, thumbnailSize(max_size));
+    if (file.isEmpty() || !QFile::exists(file)) return false;
+
+    QImageReader reader(file, "png");
+    return isCurrent(reader, path);
+}
+
+/*!
+ * Loads the cached thumbnail of the picture file at path,
+ * to be shown in max_size (it may be bigger than that).
+ *
+ * Returns a null image if there's no valid thumbnail.
+ * Thumbnails of files that have been modified since are not valid.
+ */
+QImage
+ThumbnailCache::load(const QString &path, const QSize &max_size)
+{
+    QString file = fileName(path, thumbnailSize(max_size));
+    if (file.isEmpty() || !QFile::exists(file)) return QImage();
+
+    QImageReader reader(file, "png");
+    if (!isCurrent(reader, path)) return QImage();
+
+    return reader.read();
+}
+
+/*!
+ * Stores thumbnail for the picture file at path.
+ * The thumbnail should be scaled to fit into the size of the cache
+ * (see thumbnailSize()).
+ *
+ * The file is written to a temporary file first,
+ * so that other applications never see an incomplete thumbnail.
+ */
+bool
+ThumbnailCache::save(const QString &path, const QImage &thumbnail)
+{
+    if (thumbnail.isNull()) return false;
+    QSize size = thumbnail.size();
+    QString file = fileName(path, size.width() > 128 ||
+        size.height() > 128 ? 256 : 128);
+    if (file.isEmpty()) return false;
+
+    //Don't create thumbnails of thumbnails
+    if (QFileInfo(path).absoluteFilePath().startsWith(_directory + "/"))
+        return false;
+
+    //Create directory, private
+    QString dir = QFileInfo(file).absolutePath();
+    if (!QDir(dir).exists())
+    {
+        if (!QDir().mkpath(dir)) return false;
+        QFile::setPermissions(dir,
+            QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+    }
+
+    //Required attributes
+    QString mtime = modificationTime(path);
+    if (mtime.isEmpty()) return false;
+    QImage image(thumbnail); //shallow copy
+    image.setText("Thumb::URI", QString::fromLatin1(uri(path)));
+    image.setText("Thumb::MTime", mtime);
+    image.setText("Thumb::Size", QString::number(QFileInfo(path).size()));
+    image.setText("Software", PROGRAM);
+
+    //Write temporary file (unique, loaders run in parallel), rename it
+    QString tmp_file = QString("%1.%2.tmp").arg(file)
+        .arg((quintptr)QThread::currentThreadId());
+    QFile thumbnail_file(tmp_file);
+    if (!thumbnail_file.open(QIODevice::WriteOnly)) return false;
+    thumbnail_file.setPermissions(QFile::ReadOwner | QFile::WriteOwner);
+    QImageWriter writer(&thumbnail_file, "png");
+    if (!writer.write(image))
+    {
+        thumbnail_file.close();
+        QFile::remove(tmp_file);
+        return false;
+    }
+    thumbnail_file.close();
+    QFile::remove(file);
+    return QFile::rename(tmp_file, file);
+}
+
+/*!
+ * Decodes the picture file at path in the size of the cache
+ * (to be shown in max_size) and stores the thumbnail.
+ * Returns the thumbnail (a null image if it can't be decoded).
+ */
+QImage
+ThumbnailCache::create(const QString &path, const QSize &max_size)
+{
+    int cache_size = thumbnailSize(max_size);
+    QImage image = Picture::loadThumbnail(path, QSize(cache_size, cache_size));
+    if (!image.isNull() && cache_size && !_directory.isEmpty())
+        save(path, image);
+    return image;
+}
+
+/*!
+ * Loads a thumbnail of the picture file at path, fitting into max_size.
+ *
+ * The cached thumbnail is used if there is a valid one.
+ * Otherwise, the Exif thumbnail is used if it's big enough for max_size
+ * (see Picture::loadEmbeddedThumbnail()), that's faster than decoding
+ * the picture. It's not stored, it's usually smaller than the cache size
+ * (the cache warmer creates the cached one, see create()).
+ * Otherwise, the picture is decoded in the size of the cache
+ * and stored. Thumbnails that are too big to be cached are just loaded.
+ */
+QImage
+ThumbnailCache::loadThumbnail(const QString &path, const QSize &max_size)
+{
+    int cache_size = thumbnailSize(max_size);
+    if (_directory.isEmpty() || !cache_size)
+        return Picture::loadThumbnail(path, max_size);
+
+    //Cached thumbnail
+    QImage image = load(path, max_size);
+
+    //Embedded thumbnail, already fits into max_size
+    if (image.isNull())
+    {
+        image = Picture::loadEmbeddedThumbnail(path, max_size);
+        if (!image.isNull()) return image;
+    }
+
+    //Create thumbnail in cache size, store it
+    if (image.isNull())
+        image = create(path, max_size);
+
+    //Shrink to requested size
+    if (!image.isNull() && max_size.isValid())
+        image = Picture::downscale(image, max_size);
+
+    return image;
+}
+
+QByteArray
+ThumbnailCache::uri(const QString &path)
+{
+    //Absolute uri, percent-encoded (file:///path/to/file.jpg)
+    QString absolute_path = QFileInfo(path).absoluteFilePath();
+    return QUrl::fromLocalFile(absolute_path).toEncoded();
+}
+
+bool
+ThumbnailCache::isCurrent(QImageReader &reader, const QString &path)
+{
+    //Check uri and modification time (stored in png header)
+    if (reader.text("Thumb::URI") != QString::fromLatin1(uri(path)))
+        return false;
+    QString mtime = modificationTime(path);
+    return !mtime.isEmpty() && reader.text("Thumb::MTime") == mtime;
+}
+
+QString
+ThumbnailCache::modificationTime(const QString &path)
+{
+    //Seconds since epoch
+    QFileInfo info(path);
+    if (!info.exists()) return QString();
+    return QString::number(info.lastModified().toTime_t());
+}
@@ -10,8 +10,12 @@ Wallphiller::Wallphiller(QWidget *parent, Qt::WindowFlags flags)
              tmr_check_shared_memory(0),
              _configured_interval_value(0),
              _configured_thumbnail_cache_limit(0),
+             _configured_thumbnail_warming(false),
              _current_playlist(0),
+             _scan_index(0),
              _position(-1),
+             _start_position(0),
+             _streaming_list(false),
              _de(DE::None)
 {
     //Store self reference for singleton call (cache callback)
@@ -386,6 +390,8 @@ Wallphiller::Wallphiller(QWidget *parent, Qt::WindowFlags flags)
     {
         _configured_thumbnail_cache_limit = 10; //default 10 MB
     }
+    _configured_thumbnail_warming =
+        settings.value("WarmThumbnailCache", false).toBool();
     if (settings.contains("IntervalValue"))
     {
         int value = settings.value("IntervalValue").toInt();
@@ -413,6 +419,17 @@ Wallphiller::Wallphiller(QWidget *parent, Qt::WindowFlags flags)
         QTimer::singleShot(0, this, SLOT(minimizeToTray()));
     }
 
+    //Directory index, kept next to the config file
+    //Unchanged directories are not read again when the list is generated
+    QString config_dir = QFileInfo(settings.fileName()).absolutePath();
+    _scan_index = new ScanIndex;
+    _scan_index->load(config_dir + "/scanindex");
+    Scan::setIndex(_scan_index);
+
+    //Thumbnails are stored in the shared thumbnail directory
+    //Thumbnails created by file managers are used as well
+    ThumbnailCache::setDirectory(ThumbnailCache::defaultDirectory());
+
     //Restore playlist
     //This may start the timer
     //Playlist continues where it was stopped last time
@@ -461,6 +478,14 @@ Wallphiller::~Wallphiller()
     //Explicitly detach from the shared memory segment
     shared_memory.detach();
 
+    //Delete playlists first, they wait for their scanner threads,
+    //which might still be using the index
+    qDeleteAll(findChildren<Playlist*>());
+    _current_playlist = 0;
+    if (!dont_touch_config) _scan_index->save(); //thumbnail colors
+    Scan::setIndex(0);
+    delete _scan_index;
+
 }
 
 void
@@ -896,6 +921,13 @@ const
     return _configured_thumbnail_cache_limit;
 }
 
+bool
+Wallphiller::isThumbnailWarmingEnabled()
+const
+{
+    return _configured_thumbnail_warming;
+}
+
 int
 Wallphiller::intervalValue()
 const
@@ -951,6 +983,33 @@ const
     return _sorted_picture_addresses;
 }
 
+/*!
+ * Returns the average colors of the pictures at the given addresses
+ * (keyed by address), as far as the scan index knows them.
+ * The index is keyed by file path, addresses are urls.
+ */
+QHash<QString, QRgb>
+Wallphiller::placeholderColors(const QStringList &addresses)
+const
+{
+    QStringList files;
+    QHash<QString, QString> addresses_by_file;
+    foreach (QString address, addresses)
+    {
+        QString file = QUrl(address).toLocalFile();
+        if (file.isEmpty()) continue; //not a local file
+        files << file;
+        addresses_by_file.insert(file, address);
+    }
+
+    QHash<QString, QRgb> colors;
+    QHash<QString, quint32> file_colors = _scan_index->colors(files);
+    QHash<QString, quint32>::const_iterator it;
+    for (it = file_colors.constBegin(); it != file_colors.constEnd(); ++it)
+        colors.insert(addresses_by_file.value(it.key()), it.value());
+    return colors;
+}
+
 DE
 Wallphiller::desktopEnvironment()
 const
@@ -1091,13 +1150,61 @@ Wallphiller::applyCacheLimit(int max_mb)
 
 }
 
+void
+Wallphiller::applyThumbnailWarming(bool enable)
+{
+    //Start or stop creating thumbnails in the background
+    _configured_thumbnail_warming = enable;
+    Playlist *playlist = this->playlist();
+    if (playlist && enable && !playlist->isGenerating())
+        playlist->warmThumbnailCache(thumbnailbox->previewSizeLimit());
+    else if (playlist && !enable)
+        playlist->stopWarmingThumbnailCache();
+
+    //Save setting
+    QSettings settings;
+    settings.setValue("WarmThumbnailCache", enable);
+
+}
+
 void
 Wallphiller::generateList()
+{
+    //Generate list in the background
+    //The list is applied when it's ready, see applyGeneratedList()
+    Playlist *playlist = this->playlist();
+    if (!playlist || playlist->isGenerating()) return;
+    statusBar()->showMessage(tr("Scanning..."));
+
+    //Nothing to show yet, show pictures while they're being found
+    _streaming_list = _sorted_picture_addresses.isEmpty();
+
+    playlist->generateInBackground(Playlist::Order::Random);
+
+}
+
+void
+Wallphiller::applyGeneratedList()
 {
     //Get generated list
     Playlist *playlist = this->playlist();
-    playlist->generate(Playlist::Order::Random);
+    if (!playlist || sender() != playlist) return; //old playlist
     QStringList new_list = playlist->pictureAddressList();
+    statusBar()->clearMessage();
+    _streaming_list = false;
+
+    //Save directory index, next startup will be faster
+    if (!dont_touch_config) _scan_index->save();
+
+    //Position in new list
+    //-1 keeps the current picture, -2 is the end of the list
+    QString current_address = _sorted_picture_addresses.value(_position);
+    int new_position = _start_position;
+    if (new_position == -1)
+        new_position = qMax(new_list.indexOf(current_address), 0);
+    else if (new_position == -2)
+        new_position = new_list.count() - 1;
+    if (!new_list.isEmpty()) _start_position = -1; //else first added one
 
     //Apply list
     _sorted_picture_addresses = new_list;
@@ -1107,9 +1214,120 @@ Wallphiller::generateList()
     //The Playlist actually does the loading (only it knows how)
     thumbnailbox->setList(_sorted_picture_addresses,
         ThumbnailBox::SourceType::External);
+    thumbnailbox->setPlaceholderColors(
+        placeholderColors(_sorted_picture_addresses));
+
+    //Create missing thumbnails in the background (if enabled)
+    if (_configured_thumbnail_warming)
+        playlist->warmThumbnailCache(thumbnailbox->previewSizeLimit());
 
     //TODO notify if playlist empty but don't show annoying message box
 
+    //Select picture, don't change the wallpaper if it's the current one
+    if (new_position >= 0 && new_position < new_list.count() &&
+        new_list.at(new_position) == current_address)
+    {
+        _position = new_position;
+        thumbnailbox->select(new_position, false);
+        thumbnailbox->ensureItemVisible(new_position);
+    }
+    else
+    {
+        selectWallpaper(new_position);
+    }
+
+}
+
+void
+Wallphiller::appendPictures(const QStringList &addresses)
+{
+    //New pictures found by the scan (streaming_list) or by the watcher
+    //While a new list is being generated, the old list is kept
+    //until the new one is ready, unless the old one was empty
+    Playlist *playlist = this->playlist();
+    if (!playlist || sender() != playlist) return; //old playlist
+    if (playlist->isGenerating() && !_streaming_list) return;
+
+    //Append new pictures (not shuffled)
+    _sorted_picture_addresses << addresses;
+    if (!thumbnailbox->count())
+        thumbnailbox->setList(_sorted_picture_addresses,
+            ThumbnailBox::SourceType::External);
+    else
+        thumbnailbox->append(addresses);
+    thumbnailbox->setPlaceholderColors(placeholderColors(addresses));
+
+    //Select start picture as soon as it's there
+    //It's kept when the complete list arrives
+    if (_start_position >= 0 &&
+        _start_position < _sorted_picture_addresses.count())
+    {
+        selectWallpaper(_start_position);
+        _start_position = -1;
+    }
+
+}
+
+void
+Wallphiller::removePictures(const QStringList &addresses)
+{
+    //Pictures deleted (reported by the playlist's watcher)
+    Playlist *playlist = this->playlist();
+    if (!playlist || sender() != playlist) return; //old playlist
+
+    //Remove pictures, update position
+    //If the current picture is removed, next() continues
+    //with the picture that followed it
+    //The thumbnail box shows the same list, its index is used
+    //to skip the unaffected part of the list
+    QSet<QString> removed_addresses;
+    int first = _sorted_picture_addresses.count();
+    foreach (QString address, addresses)
+    {
+        int i = thumbnailbox->indexOf(address);
+        if (i == -1) continue;
+        removed_addresses.insert(address);
+        first = qMin(first, i);
+    }
+    if (removed_addresses.isEmpty()) return;
+    QStringList &list = _sorted_picture_addresses; //reference
+    int new_position = _position;
+    int j = first;
+    for (int i = first, ii = list.count(); i < ii; i++)
+    {
+        if (!removed_addresses.contains(list.at(i)))
+        {
+            if (j != i) list[j] = list.at(i);
+            j++;
+            continue;
+        }
+        if (i <= _position) new_position--;
+    }
+    list.erase(list.begin() + j, list.end());
+    _position = new_position;
+
+    thumbnailbox->remove(addresses);
+
+}
+
+void
+Wallphiller::showScanProgress(int directories, int files)
+{
+    statusBar()->showMessage(tr("Scanning... %1 directories, %2 pictures").
+        arg(directories).arg(files));
+}
+
+void
+Wallphiller::showImportProgress(int checked, int total)
+{
+    statusBar()->showMessage(tr("Adding pictures... %1 of %2").
+        arg(checked).arg(total));
+}
+
+void
+Wallphiller::showImportResult(int added)
+{
+    statusBar()->showMessage(tr("%1 pictures added").arg(added), 5000);
 }
 
 void
@@ -1122,10 +1340,15 @@ Wallphiller::setPlaylist(Playlist *playlist, int start_index)
     thumbnailbox->clear();
 
     //Delete old playlist
-    if (_current_playlist) _current_playlist->deleteLater();
+    if (_current_playlist)
+    {
+        _current_playlist->cancelGenerate();
+        _current_playlist->deleteLater();
+    }
     _current_playlist = 0;
     _position = -1;
     _sorted_picture_addresses.clear();
+    statusBar()->clearMessage();
 
     //Reset title
     txt_playlist_title->setText(tr("(No playlist defined)"));
@@ -1145,22 +1368,63 @@ Wallphiller::setPlaylist(Playlist *playlist, int start_index)
     //Connect ThumbnailBox to Playlist
     //Send image requests from thumbnailbox to new playlist
     //Forward image responses from playlist to thumbnailbox
+    //Requests of an old view are canceled as soon as it's scrolled
+    //Thumbnails are decoded in preview size, not in full size
+    connect(thumbnailbox,
+            SIGNAL(thumbnailRequested(const QString&, const QSize&, int, int)),
+            playlist,
+            SLOT(loadThumbnail(const QString&, const QSize&, int, int)));
     connect(thumbnailbox,
-            SIGNAL(imageRequested(const QString&)),
+            SIGNAL(viewportChanged(int)),
             playlist,
-            SLOT(loadImageInBackground(const QString&)));
+            SLOT(cancelImageRequests(int)));
     connect(playlist,
-            SIGNAL(imageLoaded(const QString&, const QImage&)),
+            SIGNAL(thumbnailLoaded(const QString&, const QImage&)),
             thumbnailbox,
             SLOT(cacheImage(const QString&, const QImage&)));
 
-    //Generate list and fill ThumbnailBox
-    generateList();
+    //Apply generated lists
+    connect(playlist,
+            SIGNAL(generated()),
+            SLOT(applyGeneratedList()));
+    connect(playlist,
+            SIGNAL(generateProgress(int, int)),
+            SLOT(showScanProgress(int, int)));
+    connect(playlist,
+            SIGNAL(picturesAdded(const QStringList&)),
+            SLOT(appendPictures(const QStringList&)));
+    connect(playlist,
+            SIGNAL(picturesRemoved(const QStringList&)),
+            SLOT(removePictures(const QStringList&)));
+    connect(playlist,
+            SIGNAL(importProgress(int, int)),
+            SLOT(showImportProgress(int, int)));
+    connect(playlist,
+            SIGNAL(importFinished(int)),
+            SLOT(showImportResult(int)));
 
+    //Show the restored list right away (if any), while scanning
     //Start with first (or specified) wallpaper
     //If no change interval is configured,
     //this will be the only automatic wallpaper change.
-    selectWallpaper(start_index);
+    QStringList restored_list = playlist->pictureAddressList();
+    if (!restored_list.isEmpty())
+    {
+        _sorted_picture_addresses = restored_list;
+        thumbnailbox->setList(_sorted_picture_addresses,
+            ThumbnailBox::SourceType::External);
+        thumbnailbox->setPlaceholderColors(
+            placeholderColors(_sorted_picture_addresses));
+        selectWallpaper(start_index);
+        _start_position = -1; //keep it when the new list arrives
+    }
+    else
+    {
+        _start_position = start_index; //select when the list arrives
+    }
+
+    //Generate list in the background, fill ThumbnailBox when done
+    generateList();
 
     //Start timer (unless disabled)
     //It might make sense to keep the timer disabled if you only
@@ -1189,13 +1453,19 @@ Wallphiller::createPlaylist(const QList<QUrl> &addresses, bool empty)
         playlist = new Playlist(*old_playlist, this);
 
     //Fill playlist
+    //Local files are imported in the background (could be thousands)
+    QStringList files;
     foreach (QUrl address, addresses)
     {
-        playlist->add(address);
+        if (address.isLocalFile() && QFileInfo(address.toLocalFile()).isFile())
+            files << address.toLocalFile();
+        else
+            playlist->add(address);
     }
 
     //Set new playlist
     setPlaylist(playlist);
+    playlist->importFiles(files);
 
 }
 
@@ -1285,11 +1555,9 @@ Wallphiller::createPlaylistWithFiles(bool empty)
     else
         playlist = new Playlist(*old_playlist, this);
 
-    //Add single files to playlist
-    playlist->addFiles(files);
-
-    //Set new playlist
+    //Add single files to playlist (in the background)
     setPlaylist(playlist);
+    playlist->importFiles(files);
 
 }
 
@@ -1506,11 +1774,10 @@ Wallphiller::previous()
     if (new_position == -1)
     {
         //End of list
-        //Regenerate list
+        //Regenerate list, continue at end when it's ready
+        _start_position = -2;
         generateList();
-
-        //Continue at end
-        new_position = _sorted_picture_addresses.count() - 1;
+        return;
     }
 
     selectWallpaper(new_position);
@@ -1523,11 +1790,10 @@ Wallphiller::next()
     if (new_position == sortedAddresses().count())
     {
         //End of list
-        //Regenerate list
+        //Regenerate list, continue at beginning when it's ready
+        _start_position = 0;
         generateList();
-
-        //Continue at beginning
-        new_position = 0;
+        return;
     }
 
     selectWallpaper(new_position);
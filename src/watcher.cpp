@@ -0,0 +1,560 @@
+#include "watcher.hpp"
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+/*! \class Watcher
+ *
+ * \brief The Watcher class reports files that are added to
+ * or removed from a set of directories.
+ *
+ * Directories are defined using setDirectories(),
+ * recursive directories are watched including all subdirectories.
+ * The trees are walked in another thread (see Walker), the directories
+ * are watched once that's done.
+ * Only files matching the filters are reported (filesAdded(),
+ * filesRemoved()). If a subdirectory is removed (or moved away),
+ * directoryRemoved() is emitted instead of reporting each file.
+ *
+ * On Linux, inotify is used, so changes are reported right away.
+ * New files are reported once they have been written (and closed)
+ * or moved into a watched directory, not when they're created,
+ * so pictures that are being copied are not reported half-written.
+ * Files that are written again are reported again.
+ * If a directory can't be watched (the inotify watch limit has been
+ * reached or inotify is not available), it is polled instead:
+ * its modification time is checked every few seconds
+ * and if it has changed, the directory is read again and compared
+ * with the previous listing. Only these directories keep a listing.
+ *
+ * If the kernel drops events (queue overflow), overflowed() is emitted,
+ * the listener should rescan everything.
+ *
+ * A directory that is renamed within a watched tree is reported
+ * as removed (old path) and its files as added (new path),
+ * it's watched under its new path.
+ *
+ */
+
+/*!
+ * Constructs a Watcher that reports files matching filters.
+ */
+Watcher::Watcher(const QStringList &filters, QObject *parent)
+       : QObject(parent),
+         _filters(filters),
+         _inotify_fd(-1),
+         _notifier(0),
+         _walker(0)
+{
+    #if defined(__linux__)
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify_fd != -1)
+    {
+        _notifier = new QSocketNotifier(_inotify_fd,
+            QSocketNotifier::Read, this);
+        connect(_notifier, SIGNAL(activated(int)), SLOT(readEvents()));
+    }
+    #endif
+
+    //Poll directories that can't be watched
+    _poll_timer.setInterval(10 * 1000);
+    connect(&_poll_timer, SIGNAL(timeout()), SLOT(poll()));
+
+}
+
+Watcher::~Watcher()
+{
+    //Stop walking
+    foreach (QThread *thread, _walkers.keys())
+    {
+        _walkers.value(thread)->cancel();
+        thread->wait();
+        delete _walkers.value(thread);
+        delete thread;
+    }
+
+    #if defined(__linux__)
+    if (_inotify_fd != -1) close(_inotify_fd); //removes all watches
+    #endif
+}
+
+/*!
+ * Returns the watched directories (not including subdirectories).
+ */
+QStringList
+Watcher::directories()
+const
+{
+    return _nonrecursive_dirs + _recursive_dirs;
+}
+
+/*!
+ * Returns the number of directories watched by inotify.
+ */
+int
+Watcher::watchCount()
+const
+{
+    return _watched_dirs.size();
+}
+
+/*!
+ * Returns the number of directories that are polled.
+ */
+int
+Watcher::pollCount()
+const
+{
+    return _polled_dirs.size();
+}
+
+/*!
+ * Returns the interval, in seconds, in which polled directories
+ * are checked.
+ */
+int
+Watcher::pollInterval()
+const
+{
+    return _poll_timer.interval() / 1000;
+}
+
+/*!
+ * Watches the given directories, replacing the previously defined ones.
+ * Nothing happens if they're the same.
+ *
+ * The directories are walked in the background, changes are reported
+ * once they're being watched.
+ * No signals are emitted for files that already exist.
+ */
+void
+Watcher::setDirectories(const QStringList &nonrecursive_dirs,
+                        const QStringList &recursive_dirs)
+{
+    if (nonrecursive_dirs == _nonrecursive_dirs &&
+        recursive_dirs == _recursive_dirs)
+        return;
+
+    clear();
+    _nonrecursive_dirs = nonrecursive_dirs;
+    _recursive_dirs = recursive_dirs;
+    if (nonrecursive_dirs.isEmpty() && recursive_dirs.isEmpty()) return;
+
+    //Create walker, move it to new thread
+    Walker *walker = new Walker(nonrecursive_dirs, recursive_dirs, _filters);
+    QThread *thread = new QThread;
+    _walkers[thread] = walker;
+    _walker = walker;
+    walker->moveToThread(thread);
+
+    //Start walker when thread starts
+    connect(thread,
+            SIGNAL(started()),
+            walker,
+            SLOT(process()));
+
+    //Stop thread when walker done (stops event loop)
+    connect(walker,
+            SIGNAL(finished()),
+            thread,
+            SLOT(quit()));
+
+    //Watch directories when thread done (event loop stopped)
+    connect(thread,
+            SIGNAL(finished()),
+            this,
+            SLOT(receiveWalk()));
+
+    thread->start();
+
+}
+
+/*!
+ * Stops watching all directories.
+ */
+void
+Watcher::clear()
+{
+    #if defined(__linux__)
+    foreach (int wd, _watched_dirs.keys())
+        inotify_rm_watch(_inotify_fd, wd);
+    #endif
+    if (_walker) _walker->cancel(); //result ignored
+    _walker = 0;
+    _watched_dirs.clear();
+    _polled_dirs.clear();
+    _poll_timer.stop();
+    _nonrecursive_dirs.clear();
+    _recursive_dirs.clear();
+}
+
+/*!
+ * Sets the interval in which polled directories are checked.
+ */
+void
+Watcher::setPollInterval(int seconds)
+{
+    if (seconds < 1) seconds = 1;
+    _poll_timer.setInterval(seconds * 1000);
+}
+
+bool
+Watcher::isMatch(const QString &name)
+const
+{
+    return _filters.isEmpty() || QDir::match(_filters, name);
+}
+
+/*!
+ * Walks the directory tree at path (only path itself if recursive
+ * is false) and returns the listings of all directories
+ * (files matching filters). Directories that are reachable
+ * through more than one path are listed once.
+ * Stops if canceled is set.
+ *
+ * This function is thread-safe.
+ */
+QList<WatcherComponents::Directory>
+Watcher::walk(const QString &path,
+              bool recursive,
+              const QStringList &filters,
+              const QAtomicInt *canceled)
+{
+    //Include components
+    using namespace ScanComponents;
+    using namespace WatcherComponents;
+
+    QList<Directory> directories;
+
+    //Walk tree (without recursion, trees can be very deep)
+    QSet<DirectoryId> visited_dirs;
+    QStringList stack;
+    stack << path;
+    while (!stack.isEmpty())
+    {
+        if (canceled && *canceled != 0) break;
+        QString dir = stack.takeLast();
+        DirectoryId dir_id = Scan::directoryId(dir);
+        if (visited_dirs.contains(dir_id)) continue;
+        visited_dirs.insert(dir_id);
+
+        //List directory (probably served by the index)
+        Directory directory;
+        directory.path = dir;
+        directory.recursive = recursive;
+        directory.mtime = ScanIndex::modificationTime(dir);
+        if (directory.mtime == -1) continue; //gone
+        Scan::list(dir, filters, directory.files, directory.dirs);
+        if (recursive)
+        {
+            for (int i = directory.dirs.size() - 1; i >= 0; i--)
+                stack << directory.dirs.at(i);
+        }
+        directories << directory;
+    }
+
+    return directories;
+}
+
+QStringList
+Watcher::addDirectory(const QString &path, bool recursive, bool list_files)
+{
+    //Walk new subdirectory right away, it's usually small
+    return watch(walk(path, recursive, _filters), list_files);
+}
+
+QStringList
+Watcher::watch(const QList<Directory> &directories, bool list_files)
+{
+    QStringList files; //files in directories, if list_files is true
+
+    foreach (Directory directory, directories)
+    {
+        QString dir = directory.path;
+        if (list_files) files << directory.files;
+
+        //Watch directory
+        bool watched = false;
+        #if defined(__linux__)
+        if (_inotify_fd != -1)
+        {
+            //Files: written or moved in (IN_CREATE would report
+            //files that are still being written), directories: created
+            uint32_t mask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE |
+                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+            int wd = inotify_add_watch(_inotify_fd,
+                QFile::encodeName(dir).constData(), mask);
+            if (wd != -1)
+            {
+                //Same wd means same directory
+                //Bind mount: both paths are valid, keep the first one
+                //Renamed (moved) directory: the old path is gone or
+                //is another directory now, so the entry is moved
+                //(otherwise removing the old path would remove the watch)
+                //The listing is not needed, changes are reported
+                if (!_watched_dirs.contains(wd) ||
+                    !(Scan::directoryId(_watched_dirs.value(wd).path) ==
+                      Scan::directoryId(dir)))
+                {
+                    directory.files.clear();
+                    directory.dirs.clear();
+                    _watched_dirs.insert(wd, directory);
+                }
+                watched = true;
+            }
+            else if (errno == ENOSPC && _polled_dirs.isEmpty())
+            {
+                qWarning() <<
+                    "inotify watch limit reached, polling directories";
+            }
+        }
+        #endif
+
+        //Poll directory if it can't be watched (keeps its listing)
+        if (!watched)
+        {
+            _polled_dirs.insert(dir, directory);
+            if (!_poll_timer.isActive()) _poll_timer.start();
+        }
+    }
+
+    return files;
+}
+
+void
+Watcher::removeDirectory(const QString &path)
+{
+    //Stop watching directory and its subdirectories
+    QString prefix = path;
+    if (!prefix.endsWith('/')) prefix += '/';
+    foreach (int wd, _watched_dirs.keys())
+    {
+        QString dir = _watched_dirs.value(wd).path;
+        if (dir != path && !dir.startsWith(prefix)) continue;
+        #if defined(__linux__)
+        inotify_rm_watch(_inotify_fd, wd);
+        #endif
+        _watched_dirs.remove(wd);
+    }
+    foreach (QString dir, _polled_dirs.keys())
+    {
+        if (dir != path && !dir.startsWith(prefix)) continue;
+        _polled_dirs.remove(dir);
+    }
+    if (_polled_dirs.isEmpty()) _poll_timer.stop();
+}
+
+void
+Watcher::readEvents()
+{
+    #if defined(__linux__)
+    QStringList added_files;
+    QStringList removed_files;
+    QStringList removed_dirs;
+    bool overflow = false;
+
+    //Read all pending events
+    char buffer[64 * 1024]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    forever
+    {
+        ssize_t length = read(_inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) break; //EAGAIN, nothing left
+
+        for (char *ptr = buffer; ptr < buffer + length; )
+        {
+            const struct inotify_event *event =
+                (const struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            //Kernel queue full, events have been dropped
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+
+            //Watch removed (directory deleted or watch removed)
+            if (event->mask & IN_IGNORED)
+            {
+                _watched_dirs.remove(event->wd);
+                continue;
+            }
+            if (!_watched_dirs.contains(event->wd)) continue;
+            Directory dir = _watched_dirs.value(event->wd);
+
+            //Directory deleted, IN_IGNORED follows
+            //Subdirectories are reported by their parent, not by themselves
+            if (event->mask & IN_DELETE_SELF)
+            {
+                if (directories().contains(dir.path))
+                    removed_dirs << dir.path;
+                continue;
+            }
+
+            //Entry in directory
+            QString name = QFile::decodeName(event->name);
+            QString path = dir.path;
+            if (!path.endsWith('/')) path += '/';
+            path += name;
+            bool added = event->mask & (IN_CREATE | IN_MOVED_TO);
+            if (event->mask & IN_ISDIR)
+            {
+                //Subdirectories only matter in recursive directories
+                if (!dir.recursive) continue;
+                if (added)
+                    added_files << addDirectory(path, true, true);
+                else
+                    removed_dirs << path;
+            }
+            else if (isMatch(name))
+            {
+                //Files are added once they're complete (see above)
+                if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                    added_files << path;
+                else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    removed_files << path;
+            }
+        }
+    }
+
+    //Stop watching removed directories
+    foreach (QString path, removed_dirs)
+        removeDirectory(path);
+
+    //Report
+    if (!removed_files.isEmpty()) emit filesRemoved(removed_files);
+    foreach (QString path, removed_dirs)
+        emit directoryRemoved(path);
+    if (!added_files.isEmpty()) emit filesAdded(added_files);
+    if (overflow) emit overflowed();
+    #endif
+}
+
+void
+Watcher::poll()
+{
+    QStringList added_files;
+    QStringList removed_files;
+    QStringList added_dirs;
+    QStringList removed_dirs;
+
+    //Check polled directories
+    foreach (QString key, _polled_dirs.keys())
+    {
+        if (!_polled_dirs.contains(key)) continue; //removed meanwhile
+        Directory &dir = _polled_dirs[key]; //reference
+
+        //Check modification time, done if unchanged
+        qint64 mtime = ScanIndex::modificationTime(dir.path);
+        if (mtime == dir.mtime) continue;
+        if (mtime == -1)
+        {
+            //Directory gone (subdirectories are handled by their parent)
+            if (directories().contains(dir.path))
+                removed_dirs << dir.path;
+            continue;
+        }
+
+        //Read directory again, compare
+        QStringList files, dirs;
+        Scan::list(dir.path, _filters, files, dirs);
+        QSet<QString> old_files = dir.files.toSet();
+        QSet<QString> new_files = files.toSet();
+        foreach (QString file, files)
+            if (!old_files.contains(file)) added_files << file;
+        foreach (QString file, dir.files)
+            if (!new_files.contains(file)) removed_files << file;
+        if (dir.recursive)
+        {
+            QSet<QString> old_dirs = dir.dirs.toSet();
+            QSet<QString> new_dirs = dirs.toSet();
+            foreach (QString path, dirs)
+                if (!old_dirs.contains(path)) added_dirs << path;
+            foreach (QString path, dir.dirs)
+                if (!new_dirs.contains(path)) removed_dirs << path;
+        }
+        dir.mtime = mtime;
+        dir.files = files;
+        dir.dirs = dirs;
+    }
+
+    //Update subdirectories
+    foreach (QString path, removed_dirs)
+        removeDirectory(path);
+    foreach (QString path, added_dirs)
+        added_files << addDirectory(path, true, true);
+
+    //Report
+    if (!removed_files.isEmpty()) emit filesRemoved(removed_files);
+    foreach (QString path, removed_dirs)
+        emit directoryRemoved(path);
+    if (!added_files.isEmpty()) emit filesAdded(added_files);
+}
+
+void
+Watcher::receiveWalk()
+{
+    //Walker thread done, watch directories (unless it's an old one)
+    QThread *thread = qobject_cast<QThread*>(sender());
+    if (!thread || !_walkers.contains(thread)) return;
+    Walker *walker = _walkers.take(thread);
+    thread->wait();
+    if (walker == _walker)
+    {
+        _walker = 0;
+        watch(walker->directories(), false);
+    }
+    delete walker;
+    thread->deleteLater();
+}
+
+/*! \class WatcherComponents::Walker
+ *
+ * \brief The Walker class walks the watched directory trees
+ * in another thread, see Watcher::walk().
+ *
+ */
+
+WatcherComponents::Walker::Walker(const QStringList &nonrecursive_dirs,
+                                  const QStringList &recursive_dirs,
+                                  const QStringList &filters)
+                         : _nonrecursive_dirs(nonrecursive_dirs),
+                           _recursive_dirs(recursive_dirs),
+                           _filters(filters),
+                           _canceled(0)
+{
+}
+
+/*!
+ * Returns the directories that have been walked.
+ */
+QList<WatcherComponents::Directory>
+WatcherComponents::Walker::directories()
+const
+{
+    return _directories;
+}
+
+void
+WatcherComponents::Walker::process()
+{
+    foreach (QString path, _nonrecursive_dirs)
+        _directories << Watcher::walk(path, false, _filters, &_canceled);
+    foreach (QString path, _recursive_dirs)
+        _directories << Watcher::walk(path, true, _filters, &_canceled);
+
+    emit finished();
+}
+
+/*!
+ * Stops walking (thread-safe).
+ */
+void
+WatcherComponents::Walker::cancel()
+{
+    _canceled.fetchAndStoreOrdered(1);
+}
@@ -0,0 +1,206 @@
+#include <QtTest>
+#include <QImage>
+
+#include "thumbnailbox.hpp"
+
+/*! \class TestImageCache
+ *
+ * \brief The TestImageCache class tests admission and eviction
+ * of the ImageCache (2Q).
+ *
+ * Every image costs 10, the FIFO queue's share is a quarter of the cache.
+ *
+ */
+
+class TestImageCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void
+    newImagesEvictedFirstIn();
+
+    void
+    reinsertedImageAdmitted();
+
+    void
+    scanKeepsMainQueue();
+
+    void
+    mainQueueLeastRecentlyUsed();
+
+    void
+    replacedImageKeepsQueue();
+
+    void
+    tooBigRejected();
+
+    void
+    setMaxCostEvicts();
+
+private:
+
+    void
+    insert(ThumbnailBoxComponents::ImageCache &cache, const QString &key);
+
+    void
+    fillMainQueue(ThumbnailBoxComponents::ImageCache &cache);
+
+};
+
+void
+TestImageCache::insert(ThumbnailBoxComponents::ImageCache &cache,
+                       const QString &key)
+{
+    QImage image(1, 1, QImage::Format_RGB32);
+    image.fill(0);
+    QVERIFY(cache.insert(key, image, 10));
+}
+
+void
+TestImageCache::fillMainQueue(ThumbnailBoxComponents::ImageCache &cache)
+{
+    //a and b are evicted from the FIFO queue, then inserted again
+    insert(cache, "a");
+    insert(cache, "b");
+    insert(cache, "c");
+    QVERIFY(!cache.contains("a"));
+    insert(cache, "a");
+    insert(cache, "b");
+    QVERIFY(cache.contains("a"));
+    QVERIFY(cache.contains("b"));
+    QVERIFY(!cache.contains("c"));
+}
+
+void
+TestImageCache::newImagesEvictedFirstIn()
+{
+    ThumbnailBoxComponents::ImageCache cache(40);
+    QCOMPARE(cache.inMaxCost(), 10);
+    insert(cache, "a");
+    insert(cache, "b");
+    insert(cache, "c");
+    insert(cache, "d");
+    QCOMPARE(cache.totalCost(), 40);
+    QCOMPARE(cache.count(), 4);
+
+    insert(cache, "e");
+    QCOMPARE(cache.totalCost(), 40);
+    QVERIFY(!cache.contains("a"));
+    QVERIFY(cache.contains("b"));
+    QVERIFY(cache.contains("e"));
+}
+
+void
+TestImageCache::reinsertedImageAdmitted()
+{
+    ThumbnailBoxComponents::ImageCache cache(40);
+    insert(cache, "a");
+    insert(cache, "b");
+    insert(cache, "c");
+    insert(cache, "d");
+    insert(cache, "e"); //a evicted, remembered
+
+    //a goes to the main queue, the oldest new image makes room
+    insert(cache, "a");
+    QVERIFY(cache.contains("a"));
+    QVERIFY(!cache.contains("b"));
+    QCOMPARE(cache.count(), 4);
+}
+
+void
+TestImageCache::scanKeepsMainQueue()
+{
+    ThumbnailBoxComponents::ImageCache cache(40);
+    insert(cache, "a");
+    insert(cache, "b");
+    insert(cache, "c");
+    insert(cache, "d");
+    insert(cache, "e");
+    insert(cache, "a"); //main queue
+
+    //Scrolling through new images only churns the FIFO queue
+    for (int i = 0; i < 20; i++)
+        insert(cache, QString("k%1").arg(i));
+    QVERIFY(cache.contains("a"));
+    QVERIFY(!cache.contains("c"));
+    QVERIFY(cache.contains("k19"));
+    QCOMPARE(cache.totalCost(), 40);
+}
+
+void
+TestImageCache::mainQueueLeastRecentlyUsed()
+{
+    //Without lookup, the older image is evicted from the main queue
+    {
+        ThumbnailBoxComponents::ImageCache cache(20);
+        fillMainQueue(cache);
+        insert(cache, "d");
+        QVERIFY(!cache.contains("a"));
+        QVERIFY(cache.contains("b"));
+        QVERIFY(cache.contains("d"));
+    }
+
+    //Lookup counts as use, contains() doesn't
+    {
+        ThumbnailBoxComponents::ImageCache cache(20);
+        fillMainQueue(cache);
+        QVERIFY(!cache.object("a").isNull());
+        QVERIFY(cache.contains("b"));
+        insert(cache, "d");
+        QVERIFY(cache.contains("a"));
+        QVERIFY(!cache.contains("b"));
+        QVERIFY(cache.contains("d"));
+    }
+}
+
+void
+TestImageCache::replacedImageKeepsQueue()
+{
+    ThumbnailBoxComponents::ImageCache cache(20);
+    fillMainQueue(cache);
+
+    //a is replaced, it's still in the main queue (and the newest one there)
+    insert(cache, "a");
+    insert(cache, "d");
+    QVERIFY(cache.contains("a"));
+    QVERIFY(!cache.contains("b"));
+}
+
+void
+TestImageCache::tooBigRejected()
+{
+    ThumbnailBoxComponents::ImageCache cache(40);
+    insert(cache, "a");
+    QImage image(1, 1, QImage::Format_RGB32);
+    QVERIFY(!cache.insert("big", image, 41));
+    QVERIFY(!cache.contains("big"));
+    QVERIFY(cache.contains("a"));
+
+    //Replacing an image with one that's too big removes it
+    QVERIFY(!cache.insert("a", image, 41));
+    QVERIFY(!cache.contains("a"));
+    QCOMPARE(cache.totalCost(), 0);
+}
+
+void
+TestImageCache::setMaxCostEvicts()
+{
+    ThumbnailBoxComponents::ImageCache cache(40);
+    insert(cache, "a");
+    insert(cache, "b");
+    insert(cache, "c");
+    insert(cache, "d");
+
+    cache.setMaxCost(20);
+    QCOMPARE(cache.maxCost(), 20);
+    QCOMPARE(cache.totalCost(), 20);
+    QVERIFY(!cache.contains("a"));
+    QVERIFY(!cache.contains("b"));
+    QVERIFY(cache.contains("c"));
+    QVERIFY(cache.contains("d"));
+}
+
+QTEST_MAIN(TestImageCache)
+#include "testimagecache.moc"
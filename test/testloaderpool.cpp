@@ -0,0 +1,199 @@
+#include <QtTest>
+#include <QUrl>
+#include <QSize>
+
+#include "playlist.hpp"
+
+/*! \class TestLoaderPool
+ *
+ * \brief The TestLoaderPool class tests the order in which LoaderPool
+ * hands out requests, after promote() and cancel().
+ *
+ * No thread is started, the requests are taken from the queues directly.
+ *
+ */
+
+class TestLoaderPool : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void
+    init();
+
+    void
+    cleanup();
+
+    void
+    priorityOrder();
+
+    void
+    promoteToVisible();
+
+    void
+    promoteKeepsHigherPriority();
+
+    void
+    promoteMatchesKind();
+
+    void
+    cancelOlderGenerations();
+
+private:
+
+    void
+    enqueue(const QString &name,
+            Playlist::ImagePriority priority,
+            int generation = -1,
+            const QSize &max_size = QSize());
+
+    QStringList
+    takeAll();
+
+    PlaylistComponents::LoaderPool
+    *_pool;
+
+};
+
+void
+TestLoaderPool::init()
+{
+    _pool = new PlaylistComponents::LoaderPool(QVariantMap(), 1);
+    _pool->_max_threads = 0; //requests stay queued
+}
+
+void
+TestLoaderPool::cleanup()
+{
+    delete _pool;
+    _pool = 0;
+}
+
+void
+TestLoaderPool::enqueue(const QString &name,
+                        Playlist::ImagePriority priority,
+                        int generation,
+                        const QSize &max_size)
+{
+    _pool->enqueue(QUrl("file:///" + name), (int)priority, generation,
+        max_size);
+}
+
+QStringList
+TestLoaderPool::takeAll()
+{
+    QStringList names;
+    PlaylistComponents::LoaderPool::Request request;
+    while (_pool->take(request))
+        names << request.url.path().mid(1);
+    return names;
+}
+
+void
+TestLoaderPool::priorityOrder()
+{
+    typedef Playlist::ImagePriority ImagePriority;
+    enqueue("b1", ImagePriority::Background);
+    enqueue("p1", ImagePriority::Prefetch);
+    enqueue("v1", ImagePriority::Visible);
+    enqueue("v2", ImagePriority::Visible);
+    enqueue("p2", ImagePriority::Prefetch);
+    enqueue("b2", ImagePriority::Background);
+    QCOMPARE(_pool->queuedCount(), 6);
+
+    //Visible last in, first out, the others first in, first out
+    QCOMPARE(takeAll(), QStringList() <<
+        "v2" << "v1" << "p1" << "p2" << "b1" << "b2");
+    QCOMPARE(_pool->queuedCount(), 0);
+}
+
+void
+TestLoaderPool::promoteToVisible()
+{
+    typedef Playlist::ImagePriority ImagePriority;
+    enqueue("v1", ImagePriority::Visible, 1);
+    enqueue("p1", ImagePriority::Prefetch, 1);
+    enqueue("b1", ImagePriority::Background);
+    enqueue("b2", ImagePriority::Background);
+
+    //Promoted request is the newest visible one
+    QVERIFY(_pool->promote(QUrl("file:///b2"), false,
+        (int)ImagePriority::Visible, 2));
+    QVERIFY(_pool->promote(QUrl("file:///b1"), false,
+        (int)ImagePriority::Prefetch, 2));
+    QVERIFY(!_pool->promote(QUrl("file:///x"), false,
+        (int)ImagePriority::Visible, 2));
+    QCOMPARE(_pool->queuedCount(), 4);
+
+    PlaylistComponents::LoaderPool::Request request;
+    QVERIFY(_pool->take(request));
+    QCOMPARE(request.url, QUrl("file:///b2"));
+    QCOMPARE(request.generation, 2);
+    QCOMPARE(takeAll(), QStringList() << "v1" << "p1" << "b1");
+}
+
+void
+TestLoaderPool::promoteKeepsHigherPriority()
+{
+    typedef Playlist::ImagePriority ImagePriority;
+    enqueue("v1", ImagePriority::Visible, 1);
+    enqueue("v2", ImagePriority::Visible, 1);
+
+    //Not demoted, not moved, but it belongs to the new generation
+    QVERIFY(_pool->promote(QUrl("file:///v1"), false,
+        (int)ImagePriority::Prefetch, 2));
+    QList<PlaylistComponents::LoaderPool::Request> canceled =
+        _pool->cancel(2);
+    QCOMPARE(canceled.size(), 1);
+    QCOMPARE(canceled.first().url, QUrl("file:///v2"));
+    QCOMPARE(takeAll(), QStringList() << "v1");
+}
+
+void
+TestLoaderPool::promoteMatchesKind()
+{
+    typedef Playlist::ImagePriority ImagePriority;
+    enqueue("a", ImagePriority::Background, -1, QSize(100, 100));
+    enqueue("b", ImagePriority::Background);
+
+    //Thumbnail request for a, image request for b
+    QVERIFY(!_pool->promote(QUrl("file:///a"), false,
+        (int)ImagePriority::Visible, 1));
+    QVERIFY(!_pool->promote(QUrl("file:///b"), true,
+        (int)ImagePriority::Visible, 1));
+    QVERIFY(_pool->promote(QUrl("file:///a"), true,
+        (int)ImagePriority::Visible, 1));
+
+    PlaylistComponents::LoaderPool::Request request;
+    QVERIFY(_pool->take(request));
+    QCOMPARE(request.url, QUrl("file:///a"));
+    QCOMPARE(request.max_size, QSize(100, 100));
+    QCOMPARE(takeAll(), QStringList() << "b");
+}
+
+void
+TestLoaderPool::cancelOlderGenerations()
+{
+    typedef Playlist::ImagePriority ImagePriority;
+    enqueue("v1", ImagePriority::Visible, 1);
+    enqueue("v2", ImagePriority::Visible, 2);
+    enqueue("v3", ImagePriority::Visible);
+    enqueue("p1", ImagePriority::Prefetch, 1);
+    enqueue("p3", ImagePriority::Prefetch, 3);
+    enqueue("b1", ImagePriority::Background, 1);
+
+    //Visible ones first, then prefetch, in queue order
+    //Background requests and requests without generation are kept
+    QList<PlaylistComponents::LoaderPool::Request> canceled =
+        _pool->cancel(2);
+    QStringList names;
+    foreach (PlaylistComponents::LoaderPool::Request request, canceled)
+        names << request.url.path().mid(1);
+    QCOMPARE(names, QStringList() << "v1" << "p1");
+    QCOMPARE(_pool->queuedCount(), 4);
+    QCOMPARE(takeAll(), QStringList() << "v3" << "v2" << "p3" << "b1");
+}
+
+QTEST_MAIN(TestLoaderPool)
+#include "testloaderpool.moc"
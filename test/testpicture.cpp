@@ -0,0 +1,183 @@
+#include <QtTest>
+#include <QImage>
+
+#include "picture.hpp"
+
+Q_DECLARE_METATYPE(QImage::Format)
+
+/*! \class TestPicture
+ *
+ * \brief The TestPicture class tests Picture::halve(), the vectorized
+ * version against the scalar one and both against the definition
+ * (rounded average of 2x2 pixels), and Picture::downscale().
+ *
+ */
+
+class TestPicture : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void
+    halve_data();
+
+    void
+    halve();
+
+    void
+    halveRounding();
+
+    void
+    downscale();
+
+private:
+
+    static QImage
+    randomImage(int width, int height, QImage::Format format, uint seed);
+
+    static QImage
+    reference(const QImage &image);
+
+};
+
+QImage
+TestPicture::randomImage(int width, int height, QImage::Format format,
+                         uint seed)
+{
+    QImage image(width, height, format);
+    qsrand(seed);
+    for (int y = 0; y < height; y++)
+    {
+        quint32 *line = (quint32*)image.scanLine(y);
+        for (int x = 0; x < width; x++)
+            line[x] = ((quint32)(qrand() & 0xFFFF) << 16) | (qrand() & 0xFFFF);
+    }
+    return image;
+}
+
+QImage
+TestPicture::reference(const QImage &image)
+{
+    QImage half(image.width() / 2, image.height() / 2, image.format());
+    for (int y = 0; y < half.height(); y++)
+    {
+        for (int x = 0; x < half.width(); x++)
+        {
+            quint32 pixel = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+            {
+                quint32 sum = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    //Raw pixels, pixel() would convert them
+                    const quint32 *line =
+                        (const quint32*)image.constScanLine(2 * y + i / 2);
+                    sum += (line[2 * x + i % 2] >> shift) & 0xFF;
+                }
+                pixel |= ((sum + 2) / 4) << shift;
+            }
+            ((quint32*)half.scanLine(y))[x] = pixel;
+        }
+    }
+    return half;
+}
+
+void
+TestPicture::halve_data()
+{
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+    QTest::addColumn<QImage::Format>("format");
+
+    //Widths around the vector sizes (2 and 4 pixels), odd sizes
+    int widths[] = { 2, 3, 4, 7, 8, 9, 10, 16, 17, 33, 64, 131 };
+    int heights[] = { 2, 5 };
+    for (int w = 0; w < 12; w++)
+    {
+        for (int h = 0; h < 2; h++)
+        {
+            QString name = QString("%1x%2").arg(widths[w]).arg(heights[h]);
+            QTest::newRow(qPrintable(name + " rgb")) << widths[w] <<
+                heights[h] << QImage::Format_RGB32;
+            QTest::newRow(qPrintable(name + " argb")) << widths[w] <<
+                heights[h] << QImage::Format_ARGB32_Premultiplied;
+        }
+    }
+}
+
+void
+TestPicture::halve()
+{
+    QFETCH(int, width);
+    QFETCH(int, height);
+    QFETCH(QImage::Format, format);
+
+    QImage image = randomImage(width, height, format, width * 31 + height);
+    QImage expected = reference(image);
+    QImage scalar = Picture::halve(image, false);
+    QImage vectorized = Picture::halve(image);
+    QCOMPARE(scalar.size(), expected.size());
+    QCOMPARE(vectorized.size(), expected.size());
+    QCOMPARE(vectorized.format(), format);
+
+    //All 32 bits (QImage's == ignores alpha of RGB32)
+    for (int y = 0; y < expected.height(); y++)
+    {
+        const quint32 *expected_line =
+            (const quint32*)expected.constScanLine(y);
+        const quint32 *scalar_line = (const quint32*)scalar.constScanLine(y);
+        const quint32 *vectorized_line =
+            (const quint32*)vectorized.constScanLine(y);
+        for (int x = 0; x < expected.width(); x++)
+        {
+            QCOMPARE(scalar_line[x], expected_line[x]);
+            QCOMPARE(vectorized_line[x], expected_line[x]);
+        }
+    }
+}
+
+void
+TestPicture::halveRounding()
+{
+    //Rounded to nearest, no overflow at 0xFF
+    QImage image(4, 2, QImage::Format_ARGB32_Premultiplied);
+    quint32 *line0 = (quint32*)image.scanLine(0);
+    quint32 *line1 = (quint32*)image.scanLine(1);
+    line0[0] = 0x00000000; line0[1] = 0x00000001;
+    line1[0] = 0x00000102; line1[1] = 0x00010203;
+    line0[2] = 0xFFFFFFFF; line0[3] = 0xFFFFFFFF;
+    line1[2] = 0xFFFFFFFF; line1[3] = 0xFFFFFFFF;
+
+    foreach (bool vectorized, QList<bool>() << false << true)
+    {
+        QImage half = Picture::halve(image, vectorized);
+        QCOMPARE(half.size(), QSize(2, 1));
+        const quint32 *line = (const quint32*)half.constScanLine(0);
+        QCOMPARE(line[0], (quint32)0x00000102);
+        QCOMPARE(line[1], (quint32)0xFFFFFFFF);
+    }
+
+    //Nothing left
+    QVERIFY(Picture::halve(QImage(1, 1, QImage::Format_RGB32)).isNull());
+}
+
+void
+TestPicture::downscale()
+{
+    QImage image = randomImage(400, 300, QImage::Format_RGB32, 1);
+    QImage scaled = Picture::downscale(image, QSize(100, 100));
+    QCOMPARE(scaled.size(), QSize(100, 75));
+    QCOMPARE(scaled.format(), QImage::Format_RGB32);
+
+    //Halved twice, nothing else to do
+    scaled = Picture::downscale(image, QSize(100, 75));
+    QCOMPARE(scaled, Picture::halve(Picture::halve(image)));
+
+    //Smaller images are returned as they are
+    QImage small_image = randomImage(50, 40, QImage::Format_ARGB32, 2);
+    QCOMPARE(Picture::downscale(small_image, QSize(100, 100)), small_image);
+}
+
+QTEST_MAIN(TestPicture)
+#include "testpicture.moc"
@@ -0,0 +1,202 @@
+#include <QtTest>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QDataStream>
+
+#include "scanindex.hpp"
+
+/*! \class TestScanIndex
+ *
+ * \brief The TestScanIndex class tests saving and loading a ScanIndex.
+ *
+ */
+
+class TestScanIndex : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void
+    init();
+
+    void
+    cleanup();
+
+    void
+    roundTrip();
+
+    void
+    modifiedDirectory();
+
+    void
+    unusedEntriesDropped();
+
+    void
+    otherVersionRejected();
+
+    void
+    truncatedFileRejected();
+
+private:
+
+    void
+    fill(ScanIndex &index);
+
+    QString
+    _file;
+
+};
+
+//Old enough to be remembered (see ScanIndex::insert())
+static const qint64 MTIME = Q_INT64_C(1400000000000000000);
+
+void
+TestScanIndex::init()
+{
+    _file = QDir::tempPath() + "/wallphiller-test-" +
+        QString::number(QCoreApplication::applicationPid()) + ".index";
+    QFile::remove(_file);
+}
+
+void
+TestScanIndex::cleanup()
+{
+    QFile::remove(_file);
+    QFile::remove(_file + ".tmp");
+}
+
+void
+TestScanIndex::fill(ScanIndex &index)
+{
+    QStringList filters = QStringList() << "*.jpg" << "*.png";
+    QVERIFY(!index.load(_file)); //new file
+    index.insert("/pics", filters, MTIME,
+        QStringList() << "a.jpg" << "b.png", QStringList() << "sub");
+    index.insert("/pics/sub", filters, MTIME + 1,
+        QStringList() << "c.jpg", QStringList());
+    index.setColor("/pics/a.jpg", 0xff112233);
+    index.setColor("/pics/sub/c.jpg", 0xff445566);
+    QCOMPARE(index.count(), 2);
+}
+
+void
+TestScanIndex::roundTrip()
+{
+    QStringList filters = QStringList() << "*.jpg" << "*.png";
+    {
+        ScanIndex index;
+        fill(index);
+        QVERIFY(index.save());
+    }
+
+    ScanIndex index;
+    QVERIFY(index.load(_file));
+    QCOMPARE(index.fileName(), _file);
+    QCOMPARE(index.count(), 2);
+
+    //Listings
+    QStringList files, dirs;
+    QVERIFY(index.lookup("/pics", filters, MTIME, files, dirs));
+    QCOMPARE(files, QStringList() << "a.jpg" << "b.png");
+    QCOMPARE(dirs, QStringList() << "sub");
+    files.clear();
+    dirs.clear();
+    QVERIFY(index.lookup("/pics/sub", filters, MTIME + 1, files, dirs));
+    QCOMPARE(files, QStringList() << "c.jpg");
+    QVERIFY(dirs.isEmpty());
+
+    //Colors (files without color are not included)
+    QHash<QString, quint32> colors = index.colors(QStringList() <<
+        "/pics/a.jpg" << "/pics/b.png" << "/pics/sub/c.jpg");
+    QCOMPARE(colors.size(), 2);
+    QCOMPARE(colors.value("/pics/a.jpg"), (quint32)0xff112233);
+    QCOMPARE(colors.value("/pics/sub/c.jpg"), (quint32)0xff445566);
+}
+
+void
+TestScanIndex::modifiedDirectory()
+{
+    QStringList filters = QStringList() << "*.jpg" << "*.png";
+    {
+        ScanIndex index;
+        fill(index);
+        QVERIFY(index.save());
+    }
+
+    ScanIndex index;
+    QVERIFY(index.load(_file));
+    QStringList files, dirs;
+    QVERIFY(!index.lookup("/pics", filters, MTIME + 5, files, dirs));
+    QVERIFY(!index.lookup("/pics", QStringList() << "*.jpg", MTIME,
+        files, dirs));
+    QVERIFY(!index.lookup("/other", filters, MTIME, files, dirs));
+    QVERIFY(files.isEmpty());
+    QVERIFY(dirs.isEmpty());
+}
+
+void
+TestScanIndex::unusedEntriesDropped()
+{
+    QStringList filters = QStringList() << "*.jpg" << "*.png";
+    {
+        ScanIndex index;
+        fill(index);
+        QVERIFY(index.save());
+    }
+
+    //Only /pics is used after loading
+    {
+        ScanIndex index;
+        QVERIFY(index.load(_file));
+        QStringList files, dirs;
+        QVERIFY(index.lookup("/pics", filters, MTIME, files, dirs));
+        QVERIFY(index.save());
+    }
+
+    ScanIndex index;
+    QVERIFY(index.load(_file));
+    QCOMPARE(index.count(), 1);
+    QHash<QString, quint32> colors = index.colors(QStringList() <<
+        "/pics/a.jpg" << "/pics/sub/c.jpg");
+    QCOMPARE(colors.size(), 1);
+    QVERIFY(colors.contains("/pics/a.jpg"));
+}
+
+void
+TestScanIndex::otherVersionRejected()
+{
+    {
+        QFile file(_file);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QDataStream stream(&file);
+        stream << (quint32)0x57505349 << (quint32)2;
+        stream << (QStringList() << "*.jpg") << (quint32)0;
+    }
+
+    ScanIndex index;
+    QVERIFY(!index.load(_file));
+    QCOMPARE(index.count(), 0);
+}
+
+void
+TestScanIndex::truncatedFileRejected()
+{
+    {
+        ScanIndex index;
+        fill(index);
+        QVERIFY(index.save());
+    }
+    {
+        QFile file(_file);
+        QVERIFY(file.resize(file.size() - 8));
+    }
+
+    ScanIndex index;
+    QVERIFY(!index.load(_file));
+    QCOMPARE(index.count(), 0);
+}
+
+QTEST_MAIN(TestScanIndex)
+#include "testscanindex.moc"